@@ -1,5 +1,121 @@
 #include "shell.h"
 #include "client.h"
+#include "timeout.h"
+#include "limits.h"
+#include "protocol.h"
+#include "script.h"
+#include "trace.h"
+#include "transfer.h"
+#include "zygote.h"
+#include "console.h"
+#include "heartbeat.h"
+#include "session.h"
+#include "heredoc.h"
+
+/**
+ * @brief Writes the status line sent back to the server after a command or a script.
+ *
+ * @param response Buffer receiving the line.
+ * @param size Size of the buffer.
+ * @param status The exit status of the command.
+ */
+static void format_response(char *response, size_t size, int status) {
+    if (command_timed_out) {
+        snprintf(response, size, "%s %d", CLIENT_TIMEOUT_RESPONSE, status);
+    } else if (status == 0) {
+        snprintf(response, size, "%s", CLIENT_SUCCESS_RESPONSE);
+    } else {
+        snprintf(response, size, "%s %d", CLIENT_FAILURE_RESPONSE, status);
+    }
+
+    // Report the resources used when the command ran with limits
+    if (last_command_usage.limited) {
+        char usage[MAX_LINE / 2];
+        format_usage(usage, sizeof(usage));
+        size_t length = strlen(response);
+        snprintf(response + length, size - length, " (%s)", usage);
+    }
+}
+
+/**
+ * @brief Ignores SIGPIPE: a write to a closed connection fails with EPIPE instead.
+ *
+ * A handler rather than SIG_IGN, since it is reset by execvp() and the commands
+ * of the server still get the default action.
+ */
+static void handle_sigpipe(int sig) {
+    (void)sig;
+}
+
+/**
+ * @brief Executes a frame received from the server and sends the response.
+ *
+ * @param sockfd The socket connected to the server.
+ * @param frame The frame (a command or a script).
+ * @return 0 on success, -1 if the response could not be sent.
+ */
+static int handle_server_frame(int sockfd, Frame *frame) {
+    char response[MAX_LINE];
+    int status;
+
+    if (frame->type == FRAME_TRACE) {
+        // The next command belongs to this trace of the server
+        trace_set_id(strtoull(frame->payload, NULL, 16));
+        return 0;
+    }
+    if (trace_enabled && trace_get_id() == 0) {
+        trace_set_id(trace_new_id());
+    }
+
+    if (frame->type == FRAME_COMMAND) {
+        char *command = frame->payload;
+        printf("\nCommand received: %s\n", command);
+        printf("%s> %s\n", get_path(), command);
+        add_to_history(command);
+        session_command_received();
+        if (strcmp(command, "exit_client") == 0) {
+            exit_client();
+        }
+        use_default_limits = 1;
+        status = execute_command(command);
+        use_default_limits = 0;
+
+        // Send response to the server after executing the command
+        long long response_start = TRACE_START();
+        format_response(response, sizeof(response), status);
+        int result = session_send_response(sockfd, response, strlen(response) + 1);
+        TRACE_END("response", response_start);
+        trace_set_id(0);
+        trace_flush();
+        return result;
+    }
+
+    if (frame->type == FRAME_SCRIPT) {
+        // The whole script runs before a single aggregated response is sent
+        printf("\nScript received (%u bytes)\n", frame->length - 1);
+        session_command_received();
+        use_default_limits = 1;
+        char *report = run_script(frame->payload, &status);
+        use_default_limits = 0;
+        printf("%s", report);
+
+        long long response_start = TRACE_START();
+        format_response(response, sizeof(response), status);
+        size_t length = strlen(response) + strlen(report) + 2;
+        char *full = malloc(length);
+        snprintf(full, length, "%s\n%s", response, report);
+        int result = session_send_response(sockfd, full, strlen(full) + 1);
+        free(full);
+        free(report);
+        TRACE_END("response", response_start);
+        trace_set_id(0);
+        trace_flush();
+        return result;
+    }
+
+    printf("\nUnknown frame of type '%c' ignored\n", frame->type);
+    return 0;
+}
 
 /**
  * @brief Connects the client to the server on a specified port and processes commands.
@@ -9,12 +125,22 @@
 void client(int port) {
     int sockfd = 0;
     char buffer[MAX_LINE] = {0};
+    FrameReader reader = {0};  // Frames received from the server
     struct sockaddr_in serv_addr;
     
+    // Limits applied to the commands of the server, from the environment
+    limits_load_config();
+    session_load_config();
+
+    // Optional helpers that start the commands, forked while the client is still small
+    zygote_start();
+
     // Handle signals
     signal(SIGINT, handle_sigint);
     signal(SIGTSTP, handle_sigtstp);
     signal(SIGTERM, handle_sigterm);
+    signal(SIGPIPE, handle_sigpipe);  // sendfile() has no MSG_NOSIGNAL
+    console_init(NULL, NULL, 0);
 
     // Create socket
     if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
@@ -41,10 +167,16 @@ void client(int port) {
     printf("\nConnection established with the server\n");
 
     // Main loop for interacting with the server or local commands
+    int show_prompt = 1;
+    int connection_lost = 0;
     while (1) {
-        printf("\nWaiting for a command from the server or type your own command...\n\n");
-        printf("Client ~ %s> ", get_path());
-        fflush(stdout);
+        if (show_prompt) {
+            char prompt[MAX_LINE + 12];
+            snprintf(prompt, sizeof(prompt), "Client ~ %s> ", get_path());
+            printf("\nWaiting for a command from the server or type your own command...\n\n");
+            console_prompt(prompt);
+        }
+        show_prompt = 1;
 
         // Use select() to listen for both user input and server commands
         fd_set readfds;
@@ -53,43 +185,102 @@ void client(int port) {
         FD_SET(STDIN_FILENO, &readfds);  // Monitor standard input for user commands
         int max_fd = sockfd > STDIN_FILENO ? sockfd : STDIN_FILENO;
 
+        // Monitor the timers of background commands started with 'timeout'
+        int timer_fd = timer_wheel_fd();
+        if (timer_fd != -1) {
+            FD_SET(timer_fd, &readfds);
+            if (timer_fd > max_fd) max_fd = timer_fd;
+        }
+
         int activity = select(max_fd + 1, &readfds, NULL, NULL, NULL);
         if (activity < 0) {
             perror("select error");
             break;
         }
 
-        // If a command comes from the server
+        if (timer_fd != -1 && FD_ISSET(timer_fd, &readfds)) {
+            timer_wheel_process();
+            if (activity == 1) {
+                show_prompt = 0;  // Only a tick of the timers, keep the current prompt
+                continue;
+            }
+        }
+
+        // If commands come from the server (one per frame)
         if (FD_ISSET(sockfd, &readfds)) {
-            memset(buffer, 0, MAX_LINE);
-            int valread = read(sockfd, buffer, MAX_LINE);
+            long long receive_start = TRACE_START();
+            int valread = transfer_client_read(sockfd, &reader);
             if (valread > 0) {
-                printf("\nCommand received: %s\n", buffer);
-                printf("%s> %s\n", get_path(), buffer);
-                add_to_history(buffer);
-                if (strcmp(buffer, "exit_client") == 0) {
-                    exit_client();
-                }
-                execute_command(buffer);
+                Frame frame;
+                int result;
 
-                // Send response to the server after executing the command
-                char *response = "Command executed successfully by the client";
-                send(sockfd, response, strlen(response), 0); 
+                // Chunks of a pushed file and heartbeats keep the current prompt
+                int was_receiving = transfer_client_receiving();
+                show_prompt = 0;
+                while ((result = frame_next(&reader, &frame)) == 1) {
+                    if (frame.type != FRAME_DATA && frame.type != FRAME_PING) {
+                        show_prompt = 1;
+                    }
+                    if (frame.type != FRAME_TRACE && frame.type != FRAME_DATA && frame.type != FRAME_PING) {
+                        TRACE_END("receive", receive_start);
+                    }
+                    int handled = heartbeat_client_frame(sockfd, &frame);
+                    if (handled == 0) {
+                        handled = session_client_frame(sockfd, &frame);
+                    }
+                    if (handled == 0) {
+                        handled = transfer_client_frame(sockfd, &frame);
+                    }
+                    if (handled == -1 || (handled == 0 && handle_server_frame(sockfd, &frame) == -1)) {
+                        connection_lost = 1;
+                        break;
+                    }
+                    receive_start = TRACE_START();
+                }
+                if (was_receiving && !transfer_client_receiving()) {
+                    show_prompt = 1;
+                }
+                if (result < 0) {
+                    printf("\nInvalid data received from the server.\n");
+                    connection_lost = 1;
+                }
             }
             else if (valread == 0) {
                 printf("\nServer has closed the connection.\n");
-                break;
+                connection_lost = 1;
             }
             else {
-                perror("read error");
-                break;
+                connection_lost = 1;
             }
         }
 
+        // Within the grace window, the session (and the responses the server missed) survives
+        if (connection_lost) {
+            transfer_client_reset();
+            frame_reader_free(&reader);
+            close(sockfd);
+            sockfd = session_reconnect(&serv_addr);
+            if (sockfd == -1) break;
+            connection_lost = 0;
+            show_prompt = 1;
+            continue;
+        }
+
         // If the user enters a command locally
         if (FD_ISSET(STDIN_FILENO, &readfds)) {
             memset(buffer, 0, MAX_LINE);
-            if (fgets(buffer, MAX_LINE, stdin) != NULL) {
+            int ready = console_line_ready(buffer, MAX_LINE);
+            if (ready == 0 && !FD_ISSET(sockfd, &readfds)) {
+                show_prompt = 0;  // Only part of a line was typed
+            }
+            if (ready == 1 && heredoc_incomplete(buffer)) {
+                // The bodies of the here-documents follow on the next lines, like in the shell
+                char *script = read_heredoc_lines(buffer);
+                add_to_history(script);
+                execute_command(script);
+                free(script);
+            } 
+            else if (ready == 1) {
                 // Remove the newline character
                 buffer[strcspn(buffer, "\n")] = 0;
 
@@ -104,13 +295,17 @@ void client(int port) {
     }
 
     // Close the socket before exiting
-    close(sockfd);
+    frame_reader_free(&reader);
+    if (sockfd != -1) {
+        close(sockfd);
+    }
 }
 
 /**
  * @brief Terminates the client connection gracefully.
  */
 void exit_client() {
+    session_client_close();  // The server frees the slot instead of waiting for a reconnection
     clear_history();  // Clear command history before exiting
     printf("Client closed successfully...\n\n");
     exit(EXIT_SUCCESS);
@@ -13,6 +13,11 @@
 #define PORT 2580
 #define MAX_CLIENTS 10  
 
+// Responses sent back to the server once a command has been executed
+#define CLIENT_SUCCESS_RESPONSE "Command executed successfully by the client"
+#define CLIENT_FAILURE_RESPONSE "Command failed on the client with status"
+#define CLIENT_TIMEOUT_RESPONSE "Command timed out on the client with status"
+
 void client(int port);
 void exit_client();
 
@@ -0,0 +1,584 @@
+#include "client_pool.h"
+#include "transfer.h"
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+/**
+ * @brief Reserves the memory shared by all the clients.
+ *
+ * The region is reserved once; pages are only touched when a chunk is used
+ * for the first time, so the resident memory follows the real usage and can
+ * never grow past the budget.
+ *
+ * @param arena The arena to initialize.
+ * @param budget The total memory given to the clients, in bytes.
+ * @return 0 on success, -1 on error.
+ */
+int arena_init(Arena *arena, size_t budget) {
+    memset(arena, 0, sizeof(*arena));
+    arena->num_chunks = budget / CHUNK_SIZE;
+    if (arena->num_chunks == 0) {
+        printf("Memory budget too small (minimum %d bytes)\n", CHUNK_SIZE);
+        return -1;
+    }
+
+    arena->memory = mmap(NULL, arena->num_chunks * CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena->memory == MAP_FAILED) {
+        perror("mmap error");
+        arena->memory = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases the memory of the arena.
+ */
+void arena_destroy(Arena *arena) {
+    if (arena->memory != NULL) {
+        munmap(arena->memory, arena->num_chunks * CHUNK_SIZE);
+        arena->memory = NULL;
+    }
+}
+
+/**
+ * @brief Takes a chunk from the arena.
+ *
+ * Freed chunks are reused first, otherwise the next never used chunk is taken.
+ *
+ * @return The chunk, or NULL if the budget is exhausted.
+ */
+void *arena_alloc(Arena *arena) {
+    void *chunk = NULL;
+
+    // Chunks may be left while large buffers hold the rest of the budget
+    if (arena->used < arena->num_chunks) {
+        if (arena->free_list != NULL) {
+            chunk = arena->free_list;
+            arena->free_list = *(void **)chunk;
+        }
+        else if (arena->next_unused < arena->num_chunks) {
+            chunk = arena->memory + arena->next_unused++ * CHUNK_SIZE;
+        }
+    }
+
+    if (chunk == NULL) {
+        arena->failures++;
+        return NULL;
+    }
+
+    arena->used++;
+    arena->allocations++;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    return chunk;
+}
+
+/**
+ * @brief Gives a chunk back to the arena.
+ */
+void arena_free(Arena *arena, void *chunk) {
+    *(void **)chunk = arena->free_list;
+    arena->free_list = chunk;
+    arena->used--;
+}
+
+/**
+ * @brief Allocates or grows a buffer larger than a chunk, charged to the budget as the chunks it spans.
+ *
+ * Chunks are not contiguous, so the buffer itself comes from realloc(), but the
+ * arena hands out that many chunks less until it is freed. The chunks of the
+ * old buffer are given back first, so growing it only needs the difference,
+ * and they stay charged if the buffer cannot grow (it is left untouched).
+ *
+ * @param buffer The buffer to grow, or NULL for a new one.
+ * @param old_size The size of the buffer to grow.
+ * @param size The size wanted.
+ * @return The buffer, or NULL if the budget is exhausted or malloc() failed.
+ */
+static void *arena_realloc_large(Arena *arena, void *buffer, size_t old_size, size_t size) {
+    size_t held = buffer != NULL ? old_size / CHUNK_SIZE + 1 : 0;
+    size_t needed = size / CHUNK_SIZE + 1;
+    if (arena->used - held + needed > arena->num_chunks) {
+        arena->failures++;
+        return NULL;
+    }
+
+    void *large = realloc(buffer, size);
+    if (large == NULL) {
+        arena->failures++;
+        return NULL;
+    }
+    arena->used += needed - held;
+    arena->allocations++;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    return large;
+}
+
+/**
+ * @brief Frees a buffer from arena_realloc_large(), giving its chunks back to the budget.
+ */
+static void arena_free_large(Arena *arena, void *buffer, size_t size) {
+    free(buffer);
+    arena->used -= size / CHUNK_SIZE + 1;
+}
+
+/**
+ * @brief Takes a chunk for a client, within its memory cap.
+ */
+static void *client_alloc(ClientInfo *client) {
+    if (client->chunks >= client->cap_chunks) {
+        return NULL;
+    }
+    void *chunk = arena_alloc(client->arena);
+    if (chunk != NULL) {
+        client->chunks++;
+    }
+    return chunk;
+}
+
+/**
+ * @brief Gives a chunk of a client back to the arena.
+ */
+static void client_release(ClientInfo *client, void *chunk) {
+    arena_free(client->arena, chunk);
+    client->chunks--;
+}
+
+/**
+ * @brief Initializes the state of a newly accepted client.
+ *
+ * @param client The free slot of the client.
+ * @param arena The arena the buffers come from.
+ * @param cap The memory the client may hold, in bytes.
+ * @param socket_fd The socket of the client.
+ * @param address The address of the client.
+ * @return 0 on success, -1 if the memory budget is exhausted.
+ */
+int client_attach(ClientInfo *client, Arena *arena, size_t cap, int socket_fd, struct sockaddr_in *address) {
+    memset(client, 0, sizeof(*client));
+    client->arena = arena;
+    client->cap_chunks = cap / CHUNK_SIZE;
+    if (client->cap_chunks == 0) {
+        client->cap_chunks = 1;
+    }
+
+    client->in_buf = client_alloc(client);
+    if (client->in_buf == NULL) {
+        return -1;
+    }
+    client->socket_fd = socket_fd;
+    client->address = *address;
+    output_open(&client->output, arena, address);
+
+    // A busy client cannot answer pings: the kernel probes its connection instead
+    if (heartbeat_interval_ms > 0) {
+        int on = 1;
+        int seconds = heartbeat_interval_ms >= 1000 ? heartbeat_interval_ms / 1000 : 1;
+        unsigned int timeout_ms = heartbeat_interval_ms * heartbeat_max_missed;
+        if (setsockopt(socket_fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) == -1 ||
+            setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPIDLE, &seconds, sizeof(seconds)) == -1 ||
+            setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPINTVL, &seconds, sizeof(seconds)) == -1 ||
+            setsockopt(socket_fd, IPPROTO_TCP, TCP_KEEPCNT, &heartbeat_max_missed, sizeof(int)) == -1 ||
+            setsockopt(socket_fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout_ms, sizeof(timeout_ms)) == -1) {
+            perror("setsockopt error");
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Closes the socket of a client and gives its buffers back to the arena, keeping its session.
+ */
+void client_disconnect(ClientInfo *client) {
+    if (client->socket_fd > 0) {
+        close(client->socket_fd);
+    }
+    if (client->transfer != NULL) {
+        transfer_abort(client);
+    }
+
+    OutChunk *chunk = client->out_head;
+    while (chunk != NULL) {
+        OutChunk *next = chunk->next;
+        client_release(client, chunk);
+        chunk = next;
+    }
+    if (client->in_buf != NULL) {
+        client_release(client, client->in_buf);
+    }
+    if (client->in_large != NULL) {
+        arena_free_large(client->arena, client->in_large, client->in_large_size);
+        client->chunks -= client->in_large_size / CHUNK_SIZE + 1;
+    }
+
+    client->socket_fd = 0;
+    client->in_buf = NULL;
+    client->in_len = 0;
+    client->in_used = 0;
+    client->in_large = NULL;
+    client->in_large_size = 0;
+    client->out_head = NULL;
+    client->out_tail = NULL;
+}
+
+/**
+ * @brief Closes the socket of a client and gives all its buffers back to the arena.
+ */
+void client_detach(ClientInfo *client) {
+    client_disconnect(client);
+    output_close(&client->output);
+    if (client->grace.pending) {
+        timer_cancel(&client->grace);
+    }
+    client->session[0] = '\0';
+    client->session_expired = 0;
+}
+
+/**
+ * @brief Keeps data in the output chunks of a client until its socket is writable.
+ *
+ * @return 0 on success, -1 if the client exceeds its memory cap.
+ */
+static int client_queue(ClientInfo *client, const char *data, size_t length) {
+    while (length > 0) {
+        OutChunk *tail = client->out_tail;
+        if (tail == NULL || tail->length == OUT_CHUNK_DATA) {
+            tail = client_alloc(client);
+            if (tail == NULL) {
+                printf("Client socket %d exceeded its memory cap, dropping it\n", client->socket_fd);
+                return -1;
+            }
+            tail->next = NULL;
+            tail->length = 0;
+            tail->offset = 0;
+            if (client->out_tail != NULL) {
+                client->out_tail->next = tail;
+            } else {
+                client->out_head = tail;
+            }
+            client->out_tail = tail;
+        }
+
+        size_t size = OUT_CHUNK_DATA - tail->length;
+        if (size > length) size = length;
+        memcpy(tail->data + tail->length, data, size);
+        tail->length += size;
+        data += size;
+        length -= size;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sends data to a client without blocking.
+ *
+ * What the socket does not accept right away is kept in the output chunks of
+ * the client and sent by client_flush() once the socket is writable.
+ *
+ * @param client The client.
+ * @param data The data to send.
+ * @param length The number of bytes to send.
+ * @return 0 on success, -1 on error or if the client exceeds its memory cap.
+ */
+int client_send(ClientInfo *client, const char *data, size_t length) {
+    // Nothing is waiting: try to send directly
+    if (client->out_head == NULL) {
+        ssize_t sent = send(client->socket_fd, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("send error");
+                return -1;
+            }
+            sent = 0;
+        }
+        client->bytes_out += sent;
+        data += sent;
+        length -= sent;
+    }
+
+    // Keep the rest for later
+    return client_queue(client, data, length);
+}
+
+/**
+ * @brief Sends a frame to a client without blocking.
+ *
+ * The header and the payload are given to the socket in a single call, the
+ * part it does not accept is queued like in client_send().
+ *
+ * @return 0 on success, -1 on error or if the client exceeds its memory cap.
+ */
+int client_send_frame(ClientInfo *client, char type, const char *payload, size_t length) {
+    char header[FRAME_HEADER_SIZE];
+    size_t sent = 0;
+
+    frame_header(header, type, length);
+    if (client->out_head == NULL) {
+        struct iovec parts[2] = {{header, FRAME_HEADER_SIZE}, {(char *)payload, length}};
+        struct msghdr message = {0};
+        message.msg_iov = parts;
+        message.msg_iovlen = 2;
+
+        ssize_t result = sendmsg(client->socket_fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (result < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("send error");
+                return -1;
+            }
+            result = 0;
+        }
+        sent = result;
+        client->bytes_out += sent;
+    }
+
+    if (sent < FRAME_HEADER_SIZE) {
+        if (client_queue(client, header + sent, FRAME_HEADER_SIZE - sent) == -1) return -1;
+        sent = FRAME_HEADER_SIZE;
+    }
+    return client_queue(client, payload + (sent - FRAME_HEADER_SIZE), length - (sent - FRAME_HEADER_SIZE));
+}
+
+/**
+ * @brief Sends the pending output of a client. To be called when its socket is writable.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int client_flush(ClientInfo *client) {
+    while (client->out_head != NULL) {
+        OutChunk *head = client->out_head;
+        ssize_t sent = send(client->socket_fd, head->data + head->offset, head->length - head->offset,
+                            MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            perror("send error");
+            return -1;
+        }
+        client->bytes_out += sent;
+        head->offset += sent;
+        if (head->offset < head->length) return 0;
+
+        client->out_head = head->next;
+        if (client->out_head == NULL) {
+            client->out_tail = NULL;
+        }
+        client_release(client, head);
+    }
+    return 0;
+}
+
+/**
+ * @brief Sends a command or a script to a client.
+ *
+ * When tracing, the command is preceded by its trace ID so the spans of the
+ * client join the ones of the server, and the time it was sent is kept to
+ * measure the round trip when the response arrives.
+ *
+ * @return 0 on success, -1 on error or if the client exceeds its memory cap.
+ */
+int client_send_command(ClientInfo *client, char type, const char *payload, size_t length) {
+    long long start = TRACE_START();
+    if (start != 0) {
+        char id[32];
+        if (trace_get_id() == 0) {
+            trace_set_id(trace_new_id());
+        }
+        snprintf(id, sizeof(id), "%016llx", trace_get_id());
+        if (client_send_frame(client, FRAME_TRACE, id, strlen(id) + 1) == -1) return -1;
+        client->trace_id = trace_get_id();
+        client->trace_sent = start;
+    }
+
+    int result = client_send_frame(client, type, payload, length);
+    if (result == 0) {
+        client->commands_pending++;
+        client->commands_sent++;
+    }
+    TRACE_END("send", start);
+    return result;
+}
+
+/**
+ * @brief Sends a ping to every idle client and counts the pings left unanswered.
+ *
+ * Called once per heartbeat interval by a single timer. A client running a
+ * command or moving a file answers only once it is done, so it is not pinged
+ * meanwhile (its connection is watched by TCP keepalive instead).
+ *
+ * @param clients The array of clients.
+ * @param num_clients The number of slots in the array.
+ * @return The number of clients that missed too many pings, to be evicted by the caller.
+ */
+int clients_heartbeat(ClientInfo *clients, int num_clients) {
+    int expired = 0;
+    for (int i = 0; i < num_clients; i++) {
+        ClientInfo *client = &clients[i];
+        if (client->socket_fd <= 0) continue;
+
+        if (client->commands_pending > 0 || client->transfer != NULL) {
+            client->heartbeat.sent_ms = 0;
+            client->heartbeat.missed = 0;
+            continue;
+        }
+
+        char payload[32];
+        if (heartbeat_ping(&client->heartbeat, payload, sizeof(payload)) == -1) {
+            expired++;
+            continue;
+        }
+        client_send_frame(client, FRAME_PING, payload, strlen(payload) + 1);
+    }
+    return expired;
+}
+
+/**
+ * @brief Finds the clients targeted on the console by "-all" or "-id <x> [<y> ...]".
+ *
+ * @param clients The array of clients.
+ * @param num_clients The number of slots in the array.
+ * @param target The target given on the console, modified.
+ * @param slots Receives the slots of the connected clients targeted.
+ * @return The number of clients found, or -1 if the target is not valid.
+ */
+int client_select(ClientInfo *clients, int num_clients, char *target, int *slots) {
+    char *saveptr;
+    char *flag = target != NULL ? strtok_r(target, " \t", &saveptr) : NULL;
+    if (flag == NULL || (strcmp(flag, "-all") != 0 && strcmp(flag, "-id") != 0)) {
+        return -1;
+    }
+
+    int count = 0;
+    if (strcmp(flag, "-all") == 0) {
+        for (int i = 0; i < num_clients; i++) {
+            if (clients[i].socket_fd > 0) {
+                slots[count++] = i;
+            }
+        }
+        return count;
+    }
+
+    char *id;
+    while ((id = strtok_r(NULL, " \t", &saveptr)) != NULL) {
+        int target_fd = atoi(id);
+        for (int i = 0; i < num_clients && target_fd > 0; i++) {
+            int listed = 0;
+            for (int k = 0; k < count; k++) {
+                if (slots[k] == i) listed = 1;
+            }
+            if (clients[i].socket_fd == target_fd && !listed) {
+                slots[count++] = i;
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Reads the bytes available on the socket of a client into its input buffer.
+ *
+ * @return The number of bytes read, 0 if the client closed the connection, -1 on error.
+ */
+int client_receive(ClientInfo *client) {
+    char *buffer = client->in_large != NULL ? client->in_large : client->in_buf;
+    size_t capacity = client->in_large != NULL ? client->in_large_size : CHUNK_SIZE;
+
+    ssize_t received = read(client->socket_fd, buffer + client->in_len, capacity - client->in_len);
+    if (received < 0) {
+        perror("read error");
+        return -1;
+    }
+    client->in_len += received;
+    client->bytes_in += received;
+    return received;
+}
+
+/**
+ * @brief Gives the next complete frame received from a client.
+ *
+ * A frame larger than the input chunk is assembled in a buffer of its size,
+ * counted in the chunks of the client so it stays within its memory cap, and
+ * in the arena so it stays within the budget shared by all the clients.
+ * The frame stays valid until the next call.
+ *
+ * @return 1 if a frame is available, 0 if more bytes are needed, -1 if the client
+ *         sent an invalid frame or one that exceeds its memory cap or the budget.
+ */
+int client_next_frame(ClientInfo *client, Frame *frame) {
+    char *buffer = client->in_large != NULL ? client->in_large : client->in_buf;
+
+    // Drop the frame handled last time
+    if (client->in_used > 0) {
+        memmove(buffer, buffer + client->in_used, client->in_len - client->in_used);
+        client->in_len -= client->in_used;
+        client->in_used = 0;
+
+        // Back to the chunk once the large frame is handled
+        if (client->in_large != NULL && client->in_len <= CHUNK_SIZE) {
+            memcpy(client->in_buf, client->in_large, client->in_len);
+            arena_free_large(client->arena, client->in_large, client->in_large_size);
+            client->chunks -= client->in_large_size / CHUNK_SIZE + 1;
+            client->in_large = NULL;
+            client->in_large_size = 0;
+            buffer = client->in_buf;
+        }
+    }
+
+    int size = frame_parse(buffer, client->in_len, frame);
+    if (size > 0) {
+        client->in_used = size;
+        return 1;
+    }
+    if (size < 0 || client->in_len < FRAME_HEADER_SIZE) {
+        return size;
+    }
+
+    size_t frame_size = FRAME_HEADER_SIZE + frame->length;
+    size_t capacity = client->in_large != NULL ? client->in_large_size : CHUNK_SIZE;
+    if (frame_size > capacity) {
+        size_t held = client->in_large != NULL ? client->in_large_size / CHUNK_SIZE + 1 : 0;
+        size_t needed = frame_size / CHUNK_SIZE + 1;
+        if (client->chunks - held + needed > client->cap_chunks) {
+            printf("Client socket %d sent a frame larger than its memory cap\n", client->socket_fd);
+            return -1;
+        }
+        // A large buffer grows in place, the bytes of the chunk are copied into a new one
+        char *large = arena_realloc_large(client->arena, client->in_large, client->in_large_size, frame_size);
+        if (large == NULL) {
+            printf("Memory budget exhausted, client socket %d cannot send a frame of %zu bytes\n",
+                   client->socket_fd, frame_size);
+            return -1;
+        }
+        if (client->in_large == NULL) {
+            memcpy(large, client->in_buf, client->in_len);
+        }
+        client->chunks += needed - held;
+        client->in_large = large;
+        client->in_large_size = frame_size;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints the usage of the arena and the memory held by each client.
+ */
+void print_memory_stats(Arena *arena, ClientInfo *clients, int num_clients) {
+    printf("\nMemory budget: %zu chunks of %d bytes (%zu KB)\n",
+           arena->num_chunks, CHUNK_SIZE, arena->num_chunks * CHUNK_SIZE / 1024);
+    printf("  in use: %zu, peak: %zu, allocations: %lu, refused: %lu\n",
+           arena->used, arena->peak, arena->allocations, arena->failures);
+    for (int i = 0; i < num_clients; i++) {
+        if (clients[i].socket_fd > 0) {
+            printf("  client socket %d: %zu/%zu chunks (+%zu of history), %lu bytes in, %lu bytes out\n",
+                   clients[i].socket_fd, clients[i].chunks, clients[i].cap_chunks, clients[i].output.num_chunks,
+                   clients[i].bytes_in, clients[i].bytes_out);
+        }
+    }
+    printf("\n");
+}
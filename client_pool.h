@@ -0,0 +1,90 @@
+#ifndef CLIENT_POOL_H
+#define CLIENT_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "protocol.h"
+#include "output_log.h"
+#include "trace.h"
+#include "heartbeat.h"
+#include "timer_wheel.h"
+
+#define CHUNK_SIZE 2048                          // Size of the buffers given to the clients
+#define DEFAULT_MEMORY_BUDGET (4 * 1024 * 1024)  // Memory shared by all the clients
+#define DEFAULT_CLIENT_CAP (64 * 1024)           // Memory a single client may hold
+
+// Slab allocator handing out fixed-size chunks from a single region reserved at startup
+typedef struct Arena {
+    char *memory;              // Region holding every chunk
+    size_t num_chunks;
+    void *free_list;           // Free chunks, linked through their first bytes
+    size_t next_unused;        // First chunk never handed out
+    size_t used;               // Chunks currently allocated, large buffers included
+    size_t peak;               // Highest number of chunks allocated at once
+    unsigned long allocations; // Total number of successful allocations
+    unsigned long failures;    // Allocations refused because the budget was reached
+} Arena;
+
+// Pending output of a client, stored in arena chunks
+typedef struct OutChunk {
+    struct OutChunk *next;
+    size_t length;             // Bytes stored in data
+    size_t offset;             // Bytes already sent
+    char data[];
+} OutChunk;
+
+#define OUT_CHUNK_DATA (CHUNK_SIZE - sizeof(OutChunk))
+#define SESSION_TOKEN_SIZE 33  // 128 random bits in hexadecimal
+
+// State of a client connected to the multi_server
+typedef struct {
+    int socket_fd;             // 0 for a free slot, -1 while the client may still reconnect
+    struct sockaddr_in address;
+    Arena *arena;              // Arena the buffers of the client come from
+    size_t cap_chunks;         // Maximum number of chunks the client may hold
+    size_t chunks;             // Chunks currently held
+    char *in_buf;              // Input buffer (one chunk)
+    size_t in_len;
+    size_t in_used;            // Size of the frame handled last, dropped before reading the next one
+    char *in_large;            // Frame larger than a chunk, counted in the arena and within the cap
+    size_t in_large_size;
+    OutChunk *out_head;        // Output waiting for the socket to be writable
+    OutChunk *out_tail;
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+    OutputLog output;          // Commands sent to the client and its responses
+    unsigned long long trace_id; // Trace of the command running on the client (when tracing)
+    long long trace_sent;      // Time the command was sent, 0 once answered
+    struct Transfer *transfer; // File pushed to the client or pulled from it (NULL if none)
+    int commands_pending;      // Commands and scripts sent and not answered yet
+    Heartbeat heartbeat;       // Pings and round trips
+    char session[SESSION_TOKEN_SIZE]; // Token the client gives back to reattach ("" if it cannot)
+    unsigned long commands_sent;      // Commands and scripts sent in the session
+    unsigned long responses_received; // Responses received in the session
+    Timer grace;               // Ends the session if the client is not back in time
+    int session_expired;       // Set by the grace timer, the slot is freed by the main loop
+} ClientInfo;
+
+int arena_init(Arena *arena, size_t budget);
+void arena_destroy(Arena *arena);
+void *arena_alloc(Arena *arena);
+void arena_free(Arena *arena, void *chunk);
+
+int client_attach(ClientInfo *client, Arena *arena, size_t cap, int socket_fd, struct sockaddr_in *address);
+void client_disconnect(ClientInfo *client);
+void client_detach(ClientInfo *client);
+int client_send(ClientInfo *client, const char *data, size_t length);
+int client_send_frame(ClientInfo *client, char type, const char *payload, size_t length);
+int client_send_command(ClientInfo *client, char type, const char *payload, size_t length);
+int client_flush(ClientInfo *client);
+int client_receive(ClientInfo *client);
+int client_next_frame(ClientInfo *client, Frame *frame);
+int client_select(ClientInfo *clients, int num_clients, char *target, int *slots);
+int clients_heartbeat(ClientInfo *clients, int num_clients);
+void print_memory_stats(Arena *arena, ClientInfo *clients, int num_clients);
+
+#endif
@@ -0,0 +1,242 @@
+#include "console.h"
+#include "path_index.h"
+#include <readline/readline.h>
+#include <readline/history.h>
+
+// Commands run by the shell itself
+static const char *builtins[] = {
+    "cd", "export", "unset", "help", "history", "exit", "parallel", "timeout", "limit", NULL
+};
+
+// Words ending a command sent by the multi_server
+static const char *target_options[] = {"-all", "-id", NULL};
+
+static int interactive = 0;                 // 1 when stdin is a terminal and readline is used
+static const char **console_commands = NULL; // Commands of the server console (NULL elsewhere)
+static ClientInfo *console_clients = NULL;   // Clients completed after "-id" (multi_server)
+static int console_num_clients = 0;
+
+static int handler_installed = 0;           // Readline waits for a line typed between two select() calls
+static char *typed_line = NULL;
+static int line_state = 0;                  // 1 once a line is typed, -1 at the end of the input
+
+/**
+ * @brief Tells if the word starting at a position of the line is a command name.
+ */
+static int is_command_position(const char *line, int start) {
+    while (start > 0 && (line[start - 1] == ' ' || line[start - 1] == '\t')) start--;
+    return start == 0 || line[start - 1] == '|' || line[start - 1] == '&' || line[start - 1] == ';';
+}
+
+/**
+ * @brief Gives the matches of a list of words, one per call (readline generator).
+ */
+static char *list_match(const char **words, const char *text, int state) {
+    static int position;
+    if (state == 0) position = 0;
+
+    while (words != NULL && words[position] != NULL) {
+        const char *word = words[position++];
+        if (strncmp(word, text, strlen(text)) == 0) {
+            return strdup(word);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Generator of command names: builtins, server commands, then executables of $PATH.
+ */
+static char *command_generator(const char *text, int state) {
+    static int phase;
+    static size_t position;
+    char *match;
+
+    if (state == 0) {
+        phase = 0;
+        position = 0;
+    }
+    if (phase == 0) {
+        if ((match = list_match(builtins, text, state)) != NULL) return match;
+        phase = 1;
+        state = 0;
+    }
+    if (phase == 1) {
+        if ((match = list_match(console_commands, text, state)) != NULL) return match;
+        phase = 2;
+    }
+
+    const char *name = path_index_match(text, position++);
+    return name != NULL ? strdup(name) : NULL;
+}
+
+/**
+ * @brief Generator of the targets of a server command ("-all", "-id").
+ */
+static char *option_generator(const char *text, int state) {
+    return list_match(target_options, text, state);
+}
+
+/**
+ * @brief Generator of the sockets of the connected clients, completed after "-id".
+ */
+static char *client_generator(const char *text, int state) {
+    static int position;
+    if (state == 0) position = 0;
+
+    while (position < console_num_clients) {
+        int sock = console_clients[position++].socket_fd;
+        char id[16];
+        snprintf(id, sizeof(id), "%d", sock);
+        if (sock > 0 && strncmp(id, text, strlen(text)) == 0) {
+            return strdup(id);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Chooses what the word under the cursor is completed with.
+ *
+ * Returning NULL lets readline complete a file name.
+ */
+static char **console_completion(const char *text, int start, int end) {
+    // Word before the one completed
+    int previous_end = start;
+    while (previous_end > 0 && rl_line_buffer[previous_end - 1] == ' ') previous_end--;
+    int previous_start = previous_end;
+    while (previous_start > 0 && rl_line_buffer[previous_start - 1] != ' ') previous_start--;
+    int after_id = previous_end - previous_start == 3 && strncmp(rl_line_buffer + previous_start, "-id", 3) == 0;
+
+    if (console_clients != NULL && after_id) {
+        rl_attempted_completion_over = 1;
+        return rl_completion_matches(text, client_generator);
+    }
+    if (console_commands != NULL && text[0] == '-' && !is_command_position(rl_line_buffer, start)) {
+        rl_attempted_completion_over = 1;
+        return rl_completion_matches(text, option_generator);
+    }
+    if (is_command_position(rl_line_buffer, start) && strchr(text, '/') == NULL) {
+        path_index_refresh();
+        return rl_completion_matches(text, command_generator);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Stops waiting for a line in a select() loop, putting the terminal back in its normal mode.
+ */
+static void console_restore() {
+    if (handler_installed) {
+        rl_callback_handler_remove();
+        handler_installed = 0;
+    }
+}
+
+/**
+ * @brief Enables line editing and tab completion when stdin is a terminal.
+ *
+ * Commands complete from the builtins, the console commands and an index of
+ * the executables of $PATH kept up to date by inotify; other words complete
+ * as file names, and after "-id" as the sockets of the connected clients.
+ *
+ * @param commands Commands of the server console (NULL-terminated), or NULL.
+ * @param clients Connected clients of the multi_server, or NULL.
+ * @param num_clients Number of slots of the clients.
+ */
+void console_init(const char **commands, ClientInfo *clients, int num_clients) {
+    interactive = isatty(STDIN_FILENO);
+    if (!interactive) {
+        // select() only sees what the kernel still holds: stdio must not read lines ahead
+        setvbuf(stdin, NULL, _IONBF, 0);
+        return;
+    }
+
+    console_commands = commands;
+    console_clients = clients;
+    console_num_clients = num_clients;
+    rl_readline_name = "remote_shell";
+    rl_attempted_completion_function = console_completion;
+    path_index_refresh();
+    atexit(console_restore);
+}
+
+/**
+ * @brief Reads a line, waiting for it (like fgets(), the line ends with a newline).
+ *
+ * @return The buffer, or NULL at the end of the input.
+ */
+char *console_read_line(const char *prompt, char *buffer, size_t size) {
+    if (!interactive) {
+        printf("%s", prompt);
+        fflush(stdout);
+        return fgets(buffer, size, stdin);
+    }
+
+    // A line typed for a select() loop is given up
+    console_restore();
+    char *line = readline(prompt);
+    if (line == NULL) return NULL;
+    if (line[0] != '\0') add_history(line);
+    snprintf(buffer, size, "%s\n", line);
+    free(line);
+    return buffer;
+}
+
+/**
+ * @brief Receives a line typed on the terminal (readline callback).
+ */
+static void line_typed(char *line) {
+    typed_line = line;
+    line_state = line != NULL ? 1 : -1;
+
+    // The prompt comes back once the line is handled
+    rl_callback_handler_remove();
+    handler_installed = 0;
+}
+
+/**
+ * @brief Shows the prompt of a select() loop, keeping what the user already typed.
+ */
+void console_prompt(const char *prompt) {
+    if (!interactive) {
+        printf("%s", prompt);
+        fflush(stdout);
+    }
+    else if (!handler_installed) {
+        rl_callback_handler_install(prompt, line_typed);
+        handler_installed = 1;
+    }
+    else {
+        // Messages were printed under the line being typed, draw it again
+        rl_set_prompt(prompt);
+        rl_on_new_line();
+        rl_forced_update_display();
+    }
+}
+
+/**
+ * @brief Reads what is available on stdin in a select() loop.
+ *
+ * Like fgets(), a whole line ends with a newline, so the bodies of its
+ * here-documents can be appended to it.
+ *
+ * @return 1 if a whole line is in the buffer, 0 if the line is not finished,
+ *         -1 at the end of the input.
+ */
+int console_line_ready(char *buffer, size_t size) {
+    if (!interactive) {
+        return fgets(buffer, size, stdin) != NULL ? 1 : -1;
+    }
+
+    rl_callback_read_char();
+    int state = line_state;
+    line_state = 0;
+    if (state == 1) {
+        if (typed_line[0] != '\0') add_history(typed_line);
+        snprintf(buffer, size, "%s\n", typed_line);
+        free(typed_line);
+        typed_line = NULL;
+    }
+    return state;
+}
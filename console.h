@@ -0,0 +1,12 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "shell.h"
+#include "client_pool.h"
+
+void console_init(const char **commands, ClientInfo *clients, int num_clients);
+char *console_read_line(const char *prompt, char *buffer, size_t size);
+void console_prompt(const char *prompt);
+int console_line_ready(char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,412 @@
+#include "globbing.h"
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// Entry returned by getdents64
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Memory block of the glob arena
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+// Directory listings and matched paths of the current command line, freed by glob_reset()
+static Listing *cache[GLOB_CACHE_BUCKETS];
+static ArenaBlock *arena = NULL;
+
+// Matches of the pattern being expanded
+static char **matches;
+static int num_matches;
+static int max_matches;
+
+/**
+ * @brief Allocates memory which lives until glob_reset().
+ */
+static void *glob_alloc(size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    if (arena == NULL || arena->size - arena->used < size) {
+        size_t block_size = size > GLOB_ARENA_CHUNK ? size : GLOB_ARENA_CHUNK;
+        ArenaBlock *block = malloc(sizeof(ArenaBlock) + block_size);
+        block->next = arena;
+        block->used = 0;
+        block->size = block_size;
+        arena = block;
+    }
+    void *memory = arena->data + arena->used;
+    arena->used += size;
+    return memory;
+}
+
+/**
+ * @brief Copies a string into the glob arena.
+ */
+static char *glob_strdup(const char *text) {
+    size_t length = strlen(text) + 1;
+    char *copy = glob_alloc(length);
+    memcpy(copy, text, length);
+    return copy;
+}
+
+/**
+ * @brief Forgets the listings and matches of the previous command line.
+ */
+void glob_reset() {
+    while (arena != NULL) {
+        ArenaBlock *next = arena->next;
+        free(arena);
+        arena = next;
+    }
+    memset(cache, 0, sizeof(cache));
+}
+
+/**
+ * @brief Reads a directory, using the cache when it was already read for this command line.
+ *
+ * Entries are read with getdents64 in large batches, and their d_type is kept
+ * so most callers never need to stat() them.
+ *
+ * @param path The directory ("" for the current directory).
+ * @return The listing, or NULL if the directory cannot be opened.
+ */
+static Listing *read_listing(const char *path) {
+    size_t hash = 2166136261u;
+    for (const char *p = path; *p != '\0'; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    hash %= GLOB_CACHE_BUCKETS;
+
+    for (Listing *listing = cache[hash]; listing != NULL; listing = listing->next) {
+        if (strcmp(listing->path, path) == 0) {
+            return listing;
+        }
+    }
+
+    int fd = open(path[0] == '\0' ? "." : path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    Listing *listing = glob_alloc(sizeof(Listing));
+    listing->path = glob_strdup(path);
+    listing->count = 0;
+    int capacity = 256;
+    char **names = malloc(capacity * sizeof(char *));
+    unsigned char *types = malloc(capacity);
+
+    char *buffer = malloc(GLOB_BUFFER_SIZE);
+    long size;
+    while ((size = syscall(SYS_getdents64, fd, buffer, GLOB_BUFFER_SIZE)) > 0) {
+        for (long offset = 0; offset < size;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(buffer + offset);
+            offset += entry->d_reclen;
+
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            if (listing->count == capacity) {
+                capacity *= 2;
+                names = realloc(names, capacity * sizeof(char *));
+                types = realloc(types, capacity);
+            }
+            names[listing->count] = glob_strdup(entry->d_name);
+            types[listing->count] = entry->d_type;
+            listing->count++;
+        }
+    }
+    free(buffer);
+    close(fd);
+
+    // Keep the arrays in the arena so glob_reset() frees everything at once
+    listing->names = glob_alloc(listing->count * sizeof(char *) + 1);
+    listing->types = glob_alloc(listing->count + 1);
+    memcpy(listing->names, names, listing->count * sizeof(char *));
+    memcpy(listing->types, types, listing->count);
+    free(names);
+    free(types);
+
+    listing->next = cache[hash];
+    cache[hash] = listing;
+    return listing;
+}
+
+/**
+ * @brief Tells if a word contains unescaped glob characters (*, ? or [).
+ */
+int has_glob_chars(const char *word) {
+    for (const char *p = word; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (*p == '*' || *p == '?' || *p == '[') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes the backslashes protecting glob characters, in place.
+ */
+void glob_unescape(char *word) {
+    char *out = word;
+    for (char *p = word; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') p++;
+        *out++ = *p;
+    }
+    *out = '\0';
+}
+
+/**
+ * @brief Matches one character against the element of the pattern at 'pattern'.
+ *
+ * @param matched Set to 1 if the character matches.
+ * @return The position after the element, or NULL at the end of the pattern.
+ */
+static const char *match_one(const char *pattern, char c, int *matched) {
+    if (*pattern == '\0') return NULL;
+
+    if (*pattern == '?') {
+        *matched = 1;
+        return pattern + 1;
+    }
+
+    if (*pattern == '[') {
+        const char *p = pattern + 1;
+        int negate = (*p == '!' || *p == '^');
+        int found = 0;
+        if (negate) p++;
+
+        int first = 1;
+        while (*p != '\0' && (*p != ']' || first)) {
+            char low = *p;
+            if (low == '\\' && p[1] != '\0') low = *++p;
+            char high = low;
+            if (p[1] == '-' && p[2] != '\0' && p[2] != ']') {
+                high = p[2];
+                if (high == '\\' && p[3] != '\0') {
+                    high = p[3];
+                    p++;
+                }
+                p += 2;
+            }
+            if (c >= low && c <= high) found = 1;
+            p++;
+            first = 0;
+        }
+
+        // Without a closing bracket, '[' is an ordinary character
+        if (*p == ']') {
+            *matched = found != negate;
+            return p + 1;
+        }
+    }
+
+    if (*pattern == '\\' && pattern[1] != '\0') {
+        pattern++;
+    }
+    *matched = (*pattern == c);
+    return pattern + 1;
+}
+
+/**
+ * @brief Matches a name against a pattern component (no '/' involved).
+ *
+ * Uses backtracking on the last '*' only, so the cost stays linear in practice.
+ *
+ * @return 1 if the name matches.
+ */
+static int glob_match(const char *pattern, const char *name) {
+    const char *star_pattern = NULL;
+    const char *star_name = NULL;
+
+    // A leading dot must be matched explicitly
+    if (name[0] == '.' && pattern[0] != '.') {
+        return 0;
+    }
+
+    while (*name != '\0') {
+        if (*pattern == '*') {
+            star_pattern = ++pattern;
+            star_name = name;
+            continue;
+        }
+
+        int matched = 0;
+        const char *next = match_one(pattern, *name, &matched);
+        if (next != NULL && matched) {
+            pattern = next;
+            name++;
+        }
+        else if (star_pattern != NULL) {
+            pattern = star_pattern;
+            name = ++star_name;
+        }
+        else {
+            return 0;
+        }
+    }
+
+    while (*pattern == '*') pattern++;
+    return *pattern == '\0';
+}
+
+/**
+ * @brief Joins a directory and a name.
+ */
+static void join_path(char *buffer, size_t size, const char *directory, const char *name) {
+    if (directory[0] == '\0') {
+        snprintf(buffer, size, "%s", name);
+    } else if (directory[strlen(directory) - 1] == '/') {
+        snprintf(buffer, size, "%s%s", directory, name);
+    } else {
+        snprintf(buffer, size, "%s/%s", directory, name);
+    }
+}
+
+/**
+ * @brief Tells if an entry of a listing is a directory, calling stat() only when d_type is not enough.
+ *
+ * @param follow 1 to follow symbolic links.
+ */
+static int is_directory(const char *path, unsigned char type, int follow) {
+    if (type == DT_DIR) return 1;
+    if (type != DT_UNKNOWN && (type != DT_LNK || !follow)) return 0;
+
+    struct stat info;
+    int result = follow ? stat(path, &info) : lstat(path, &info);
+    return result == 0 && S_ISDIR(info.st_mode);
+}
+
+/**
+ * @brief Adds a matching path.
+ *
+ * @return 0 on success, -1 if there are too many matches.
+ */
+static int add_match(const char *path) {
+    if (num_matches >= max_matches) return -1;
+    matches[num_matches++] = glob_strdup(path);
+    return 0;
+}
+
+/**
+ * @brief Expands the components of a pattern from 'index' onwards, inside 'directory'.
+ *
+ * @return 0 on success, -1 if there are too many matches.
+ */
+static int glob_walk(const char *directory, char **components, int index, int count) {
+    char path[MAX_LINE * 4];
+
+    if (index == count) {
+        return directory[0] != '\0' ? add_match(directory) : 0;
+    }
+
+    char *component = components[index];
+    int last = (index == count - 1);
+
+    // '**' matches any number of directories, including none (everything below when it is last)
+    if (strcmp(component, "**") == 0) {
+        if (!last && glob_walk(directory, components, index + 1, count) < 0) return -1;
+
+        Listing *listing = read_listing(directory);
+        if (listing == NULL) return 0;
+        for (int i = 0; i < listing->count; i++) {
+            if (listing->names[i][0] == '.') continue;
+            join_path(path, sizeof(path), directory, listing->names[i]);
+            if (last && add_match(path) < 0) return -1;
+            // Symbolic links are not followed to avoid cycles
+            if (is_directory(path, listing->types[i], 0)) {
+                if (glob_walk(path, components, index, count) < 0) return -1;
+            }
+        }
+        return 0;
+    }
+
+    // A literal component does not need the listing
+    if (!has_glob_chars(component)) {
+        char literal[MAX_LINE];
+        snprintf(literal, sizeof(literal), "%s", component);
+        glob_unescape(literal);
+        join_path(path, sizeof(path), directory, literal);
+
+        struct stat info;
+        if (last) {
+            return lstat(path, &info) == 0 ? add_match(path) : 0;
+        }
+        return glob_walk(path, components, index + 1, count);
+    }
+
+    Listing *listing = read_listing(directory);
+    if (listing == NULL) return 0;
+
+    for (int i = 0; i < listing->count; i++) {
+        if (!glob_match(component, listing->names[i])) continue;
+
+        join_path(path, sizeof(path), directory, listing->names[i]);
+        if (last) {
+            if (add_match(path) < 0) return -1;
+        } else if (is_directory(path, listing->types[i], 1)) {
+            if (glob_walk(path, components, index + 1, count) < 0) return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Compares two paths for qsort().
+ */
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * @brief Expands a pattern into the sorted list of matching paths.
+ *
+ * Supports '*', '?', '[...]' in each component and '**' as a whole component
+ * (any number of directories). The paths stay valid until glob_reset().
+ *
+ * @param pattern The pattern, where escaped characters are literal.
+ * @param results Array receiving the paths.
+ * @param max_results Size of the array.
+ * @return The number of matches (0 if nothing matches), or -1 if there are too many.
+ */
+int glob_expand(const char *pattern, char **results, int max_results) {
+    char copy[MAX_LINE * 4];
+    char *components[MAX_LINE];
+    int count = 0;
+
+    snprintf(copy, sizeof(copy), "%s", pattern);
+    char *position = copy;
+    const char *start = "";
+    if (*position == '/') {
+        start = "/";
+        while (*position == '/') position++;
+    }
+
+    // Split on '/', a trailing '/' gives an empty last component (only directories match)
+    components[count++] = position;
+    for (char *p = position; *p != '\0' && count < MAX_LINE; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            while (p[1] == '/') p++;
+            components[count++] = p + 1;
+        }
+    }
+
+    matches = results;
+    num_matches = 0;
+    max_matches = max_results;
+    if (glob_walk(start, components, 0, count) < 0) {
+        return -1;
+    }
+
+    qsort(results, num_matches, sizeof(char *), compare_paths);
+    return num_matches;
+}
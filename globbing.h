@@ -0,0 +1,24 @@
+#ifndef GLOBBING_H
+#define GLOBBING_H
+
+#include "shell.h"
+
+#define GLOB_BUFFER_SIZE (256 * 1024)  // Size of the getdents64 batches
+#define GLOB_CACHE_BUCKETS 256         // Buckets of the directory listing cache
+#define GLOB_ARENA_CHUNK (64 * 1024)   // Memory blocks holding the names read
+
+// Content of a directory, read once per command line
+typedef struct Listing {
+    char *path;                 // Directory ("" for the current directory)
+    int count;
+    char **names;
+    unsigned char *types;       // d_type of each entry (DT_UNKNOWN if the filesystem does not tell)
+    struct Listing *next;
+} Listing;
+
+int has_glob_chars(const char *word);
+void glob_unescape(char *word);
+int glob_expand(const char *pattern, char **results, int max_results);
+void glob_reset();
+
+#endif
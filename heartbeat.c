@@ -0,0 +1,114 @@
+#include "heartbeat.h"
+#include <time.h>
+
+long heartbeat_interval_ms = HEARTBEAT_INTERVAL_MS;
+int heartbeat_max_missed = HEARTBEAT_MAX_MISSED;
+
+/**
+ * @brief Returns the current time in milliseconds (monotonic clock).
+ */
+static double now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+/**
+ * @brief Reads the heartbeat settings of the server from the environment.
+ *
+ * SERVER_HEARTBEAT_MS is the time between two pings (0 disables them) and
+ * SERVER_HEARTBEAT_MISSES the number of pings a client may leave unanswered.
+ */
+void heartbeat_load_config() {
+    const char *value = getenv("SERVER_HEARTBEAT_MS");
+    if (value != NULL) {
+        heartbeat_interval_ms = atol(value) > 0 ? atol(value) : 0;
+    }
+    value = getenv("SERVER_HEARTBEAT_MISSES");
+    if (value != NULL && atoi(value) > 0) {
+        heartbeat_max_missed = atoi(value);
+    }
+}
+
+/**
+ * @brief Prepares the next ping of a client, counting the previous one as missed if it is unanswered.
+ *
+ * @param heartbeat The heartbeat of the client.
+ * @param payload Receives the payload of the ping.
+ * @param size Size of the payload buffer.
+ * @return 0 if the ping should be sent, -1 if the client missed too many pings.
+ */
+int heartbeat_ping(Heartbeat *heartbeat, char *payload, size_t size) {
+    if (heartbeat->sent_ms != 0) {
+        heartbeat->missed++;
+        if (heartbeat->missed >= heartbeat_max_missed) {
+            return -1;
+        }
+    }
+
+    heartbeat->sequence++;
+    heartbeat->sent_ms = now_ms();
+    snprintf(payload, size, "%lu", heartbeat->sequence);
+    return 0;
+}
+
+/**
+ * @brief Records the answer of a client to a ping.
+ *
+ * @return 1 if it answers the last ping (a round trip is measured), 0 if it is late.
+ */
+int heartbeat_pong(Heartbeat *heartbeat, const char *payload) {
+    if (heartbeat->sent_ms == 0 || strtoul(payload, NULL, 10) != heartbeat->sequence) {
+        return 0;
+    }
+
+    double rtt = now_ms() - heartbeat->sent_ms;
+    heartbeat->sent_ms = 0;
+    heartbeat->missed = 0;
+    heartbeat->last_ms = rtt;
+    heartbeat->total_ms += rtt;
+    heartbeat->samples[heartbeat->num_samples % HEARTBEAT_SAMPLES] = rtt;
+    heartbeat->num_samples++;
+    return 1;
+}
+
+/**
+ * @brief Compares two round trips, for qsort().
+ */
+static int compare_samples(const void *a, const void *b) {
+    double first = *(const double *)a;
+    double second = *(const double *)b;
+    return (first > second) - (first < second);
+}
+
+/**
+ * @brief Writes the round trips of a client: last, average and 99th percentile of the recent ones.
+ */
+void heartbeat_format(Heartbeat *heartbeat, char *text, size_t size) {
+    if (heartbeat->num_samples == 0) {
+        snprintf(text, size, "RTT: no sample yet");
+        return;
+    }
+
+    double sorted[HEARTBEAT_SAMPLES];
+    size_t count = heartbeat->num_samples < HEARTBEAT_SAMPLES ? heartbeat->num_samples : HEARTBEAT_SAMPLES;
+    memcpy(sorted, heartbeat->samples, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compare_samples);
+
+    snprintf(text, size, "RTT last %.3f ms, avg %.3f ms, p99 %.3f ms (%lu samples)%s",
+             heartbeat->last_ms, heartbeat->total_ms / heartbeat->num_samples,
+             sorted[(count * 99) / 100], heartbeat->num_samples,
+             heartbeat->missed > 0 ? ", missing pings" : "");
+}
+
+/**
+ * @brief Answers a ping of the server (client side).
+ *
+ * @return 1 if the frame was a ping, 0 if it is not a heartbeat frame, -1 if the answer could not be sent.
+ */
+int heartbeat_client_frame(int sockfd, Frame *frame) {
+    if (frame->type != FRAME_PING) {
+        return 0;
+    }
+    return send_frame(sockfd, FRAME_PONG, frame->payload, frame->length) == -1 ? -1 : 1;
+}
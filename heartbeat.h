@@ -0,0 +1,34 @@
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "protocol.h"
+
+#define HEARTBEAT_INTERVAL_MS 5000  // Default time between two pings (SERVER_HEARTBEAT_MS overrides it, 0 disables)
+#define HEARTBEAT_MAX_MISSED 3      // Default pings left unanswered before a client is evicted (SERVER_HEARTBEAT_MISSES)
+#define HEARTBEAT_SAMPLES 128       // Round trips kept for the percentile
+
+// Liveness of a client: the ping waiting for its answer and the last round trips
+typedef struct {
+    unsigned long sequence;           // Number of the last ping sent
+    double sent_ms;                   // Time the last ping was sent, 0 once answered
+    int missed;                       // Pings in a row left unanswered
+    double samples[HEARTBEAT_SAMPLES]; // Last round trips, in ms (a ring)
+    unsigned long num_samples;        // Round trips measured since the client connected
+    double total_ms;
+    double last_ms;
+} Heartbeat;
+
+extern long heartbeat_interval_ms;
+extern int heartbeat_max_missed;
+
+void heartbeat_load_config();
+int heartbeat_ping(Heartbeat *heartbeat, char *payload, size_t size);
+int heartbeat_pong(Heartbeat *heartbeat, const char *payload);
+void heartbeat_format(Heartbeat *heartbeat, char *text, size_t size);
+int heartbeat_client_frame(int sockfd, Frame *frame);
+
+#endif
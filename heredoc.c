@@ -0,0 +1,307 @@
+#include "heredoc.h"
+#include "variables.h"
+#include <linux/memfd.h>
+#include <sys/syscall.h>
+
+// Here-documents of the command line being executed, opened in order of appearance
+static HereDoc docs[MAX_HEREDOCS];
+static int num_docs = 0;
+static int next_doc = 0;
+
+/**
+ * @brief Finds the here-document operators (<< and <<-) of a line and reads their delimiters.
+ *
+ * Operators between quotes and here-strings (<<<) are ignored. A delimiter with
+ * quotes disables the expansion of the variables in the body.
+ *
+ * @param line The line (up to the first newline).
+ * @param docs Array receiving at most MAX_HEREDOCS operators.
+ * @return The number of operators found (may exceed MAX_HEREDOCS).
+ */
+static int scan_operators(const char *line, HereDoc *docs) {
+    int count = 0;
+    char quote = 0;
+
+    for (const char *p = line; *p != '\0' && *p != '\n'; p++) {
+        if (quote != 0) {
+            if (*p == quote) quote = 0;
+            continue;
+        }
+        if (*p == '\'' || *p == '"') {
+            quote = *p;
+            continue;
+        }
+        if (p[0] != '<' || p[1] != '<') continue;
+        if (p[2] == '<') {
+            p += 2;  // Here-string: its word is on the line itself
+            continue;
+        }
+
+        HereDoc doc = {0};
+        doc.expand = 1;
+        p += 2;
+        if (*p == '-') {
+            doc.strip_tabs = 1;
+            p++;
+        }
+        while (*p == ' ' || *p == '\t') p++;
+
+        // The delimiter is a word, its quotes are removed
+        size_t length = 0;
+        char word_quote = 0;
+        for (; *p != '\0' && *p != '\n'; p++) {
+            if (word_quote == 0 && (*p == '\'' || *p == '"')) {
+                word_quote = *p;
+                doc.expand = 0;
+                continue;
+            }
+            if (word_quote != 0 && *p == word_quote) {
+                word_quote = 0;
+                continue;
+            }
+            if (word_quote == 0 && strchr(" \t;|&<>", *p) != NULL) break;
+            if (length < sizeof(doc.delimiter) - 1) {
+                doc.delimiter[length++] = *p;
+            }
+        }
+        doc.delimiter[length] = '\0';
+
+        if (count < MAX_HEREDOCS) {
+            docs[count] = doc;
+        }
+        count++;
+        p--;  // The loop moves past the delimiter
+    }
+    return count;
+}
+
+/**
+ * @brief Finds the body of a here-document: the lines up to the delimiter line.
+ *
+ * @param position Start of the first line of the body.
+ * @param doc The here-document, receives its body.
+ * @return The position after the delimiter line.
+ */
+static const char *skip_body(const char *position, HereDoc *doc) {
+    size_t delimiter_length = strlen(doc->delimiter);
+
+    doc->body = (char *)position;
+    doc->missing = 0;
+    while (*position != '\0') {
+        const char *line = position;
+        const char *end = strchr(line, '\n');
+        const char *next = end != NULL ? end + 1 : line + strlen(line);
+        const char *word = line;
+        if (doc->strip_tabs) {
+            while (*word == '\t') word++;
+        }
+
+        size_t word_length = (end != NULL ? end : next) - word;
+        if (word_length == delimiter_length && strncmp(word, doc->delimiter, word_length) == 0) {
+            doc->length = line - doc->body;
+            return next;
+        }
+        position = next;
+    }
+
+    // Like other shells, the end of the text also ends the body
+    doc->length = position - doc->body;
+    doc->missing = 1;
+    return position;
+}
+
+/**
+ * @brief Finds the end of the command starting at 'text', here-document bodies included.
+ *
+ * @param text Start of the command line.
+ * @param docs Array receiving the here-documents of the line.
+ * @param count Set to the number of here-documents.
+ * @return The start of the next command line (or the end of the text).
+ */
+static const char *find_next_line(const char *text, HereDoc *docs, int *count) {
+    const char *end = strchr(text, '\n');
+    const char *position = end != NULL ? end + 1 : text + strlen(text);
+
+    *count = scan_operators(text, docs);
+    for (int k = 0; k < *count && k < MAX_HEREDOCS; k++) {
+        position = skip_body(position, &docs[k]);
+    }
+    return position;
+}
+
+/**
+ * @brief Cuts the next command of a multi-line text.
+ *
+ * A command is a line, followed by the bodies of its here-documents.
+ *
+ * @param cursor Position in the text, advanced to the next command.
+ * @return The command, or NULL at the end of the text.
+ */
+char *heredoc_next_line(char **cursor) {
+    HereDoc line_docs[MAX_HEREDOCS];
+    int count;
+    char *line = *cursor;
+
+    if (*line == '\0') {
+        return NULL;
+    }
+
+    char *next = (char *)find_next_line(line, line_docs, &count);
+    if (*next != '\0') {
+        next[-1] = '\0';
+    }
+    *cursor = next;
+    return line;
+}
+
+/**
+ * @brief Tells if a text ends inside a here-document (its delimiter line was not read yet).
+ */
+int heredoc_incomplete(const char *text) {
+    HereDoc line_docs[MAX_HEREDOCS];
+    int count;
+
+    while (*text != '\0') {
+        text = find_next_line(text, line_docs, &count);
+        for (int k = 0; k < count && k < MAX_HEREDOCS; k++) {
+            if (line_docs[k].missing) return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Separates a command from the bodies of its here-documents.
+ *
+ * The command is cut at its first newline; the bodies stay in the same buffer
+ * and are given to the command by heredoc_open_next(), in order.
+ *
+ * @param command A command, as returned by heredoc_next_line().
+ * @return 0 on success, -1 if there are too many here-documents.
+ */
+int heredoc_prepare(char *command) {
+    int count;
+    char *end = strchr(command, '\n');
+
+    num_docs = 0;
+    next_doc = 0;
+    find_next_line(command, docs, &count);
+    if (count > MAX_HEREDOCS) {
+        printf("Too many here-documents (maximum %d)\n", MAX_HEREDOCS);
+        return -1;
+    }
+
+    if (end != NULL) {
+        *end = '\0';
+    }
+    for (int k = 0; k < count; k++) {
+        docs[k].body[docs[k].length] = '\0';
+    }
+    num_docs = count;
+    return 0;
+}
+
+/**
+ * @brief Puts data in a file descriptor that can be read from the beginning.
+ *
+ * Small bodies fit in a pipe buffer, so they are written without a reader. Larger
+ * ones go to an anonymous memory file: nothing touches the filesystem and there
+ * is no temporary file to clean up.
+ *
+ * @return The file descriptor, or -1 on error.
+ */
+static int data_fd(const char *data, size_t length) {
+    int fd;
+
+    if (length <= HEREDOC_PIPE_MAX) {
+        int pipefd[2];
+        if (pipe(pipefd) == -1) {
+            perror("pipe error");
+            return -1;
+        }
+        if (length > 0 && write(pipefd[1], data, length) != (ssize_t)length) {
+            perror("write error");
+            close(pipefd[0]);
+            close(pipefd[1]);
+            return -1;
+        }
+        close(pipefd[1]);
+        return pipefd[0];
+    }
+
+    fd = syscall(SYS_memfd_create, "heredoc", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("memfd_create error");
+        return -1;
+    }
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            perror("write error");
+            close(fd);
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+/**
+ * @brief Opens the body of the next here-document of the command.
+ *
+ * @return A file descriptor to read the body from, or -1 on error.
+ */
+int heredoc_open_next() {
+    if (next_doc >= num_docs) {
+        printf("Missing here-document\n");
+        return -1;
+    }
+    HereDoc *doc = &docs[next_doc++];
+    char *text = doc->body;
+    char *stripped = NULL;
+    char *expanded = NULL;
+
+    // '<<-': remove the leading tabs of every line
+    if (doc->strip_tabs) {
+        stripped = malloc(doc->length + 1);
+        size_t length = 0;
+        int line_start = 1;
+        for (char *p = doc->body; *p != '\0'; p++) {
+            if (line_start && *p == '\t') continue;
+            stripped[length++] = *p;
+            line_start = (*p == '\n');
+        }
+        stripped[length] = '\0';
+        text = stripped;
+    }
+
+    if (doc->expand) {
+        expanded = expand_variables(text);
+        text = expanded;
+    }
+
+    int fd = data_fd(text, strlen(text));
+    free(stripped);
+    free(expanded);
+    return fd;
+}
+
+/**
+ * @brief Opens a here-string: the word followed by a newline.
+ *
+ * @return A file descriptor to read the text from, or -1 on error.
+ */
+int heredoc_open_string(const char *word) {
+    size_t length = strlen(word);
+    char *text = malloc(length + 2);
+
+    memcpy(text, word, length);
+    text[length] = '\n';
+    text[length + 1] = '\0';
+    int fd = data_fd(text, length + 1);
+    free(text);
+    return fd;
+}
@@ -0,0 +1,25 @@
+#ifndef HEREDOC_H
+#define HEREDOC_H
+
+#include "shell.h"
+
+#define MAX_HEREDOCS 16           // Here-documents on a single command line
+#define HEREDOC_PIPE_MAX 4096     // Bodies up to this size go through a pipe (PIPE_BUF), larger ones through a memfd
+
+// A here-document of the command line being executed
+typedef struct {
+    char delimiter[MAX_LINE];
+    int strip_tabs;     // 1 for '<<-': leading tabs are removed from the body and the delimiter line
+    int expand;         // 0 if the delimiter was quoted: the body is taken literally
+    char *body;         // Lines following the command, up to the delimiter line
+    size_t length;
+    int missing;        // 1 if the text ended before the delimiter line
+} HereDoc;
+
+char *heredoc_next_line(char **cursor);
+int heredoc_incomplete(const char *text);
+int heredoc_prepare(char *command);
+int heredoc_open_next();
+int heredoc_open_string(const char *word);
+
+#endif
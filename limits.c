@@ -0,0 +1,320 @@
+#include "limits.h"
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define LIMITS_USAGE "Usage: limit [mem=<size>] [cpu=<1-10000>] [pids=<n>] <command> (0 removes a limit)\n"
+
+// Limits applied to the commands received from the server (client configuration)
+ResourceLimits default_limits = {0};
+int use_default_limits = 0;  // Set by the client while it runs a command of the server
+
+// Resources used by the last command, filled by execute_command()
+CommandUsage last_command_usage = {0};
+
+static char cgroup_root[MAX_LINE / 2] = "";  // Delegated cgroup v2 subtree (empty: use rlimits)
+static unsigned long cgroup_counter = 0; // Used to name the leaf cgroups
+
+/**
+ * @brief Parses a number of digits only (no sign, no blank), followed by an optional unit.
+ *
+ * @param text The text to parse.
+ * @param number Receives the number.
+ * @param units Units accepted after the digits ("KMG" for a size, "" for a plain number).
+ * @return 0 on success, -1 if the text is not such a number or does not fit.
+ */
+static int parse_number(const char *text, unsigned long *number, const char *units) {
+    char *end;
+    if (*text < '0' || *text > '9') return -1;
+
+    errno = 0;
+    *number = strtoul(text, &end, 10);
+    if (errno == ERANGE) return -1;
+
+    // Each unit is 1024 times the previous one
+    unsigned long unit = 1;
+    const char *suffix = *end != '\0' ? strchr(units, toupper((unsigned char)*end)) : NULL;
+    if (suffix != NULL) {
+        for (const char *u = units; u <= suffix; u++) {
+            unit *= 1024;
+        }
+        end++;
+    }
+    if (*end != '\0' || *number > ULONG_MAX / unit) return -1;
+    *number *= unit;
+    return 0;
+}
+
+/**
+ * @brief Sets one limit from its text, such as "512K", "100M" or "2G" for the memory.
+ *
+ * @param key "mem", "cpu" or "pids".
+ * @param text The value given for the key.
+ * @param limits The limits to update.
+ * @return 0 on success, -1 if the key is unknown or the value invalid (a message names it).
+ */
+static int set_limit(const char *key, const char *text, ResourceLimits *limits) {
+    unsigned long value;
+
+    if (strcmp(key, "mem") == 0 && parse_number(text, &value, "KMG") == 0) {
+        limits->memory_max = value;
+    } else if (strcmp(key, "cpu") == 0 && parse_number(text, &value, "") == 0 && value <= CPU_WEIGHT_MAX) {
+        limits->cpu_weight = value;
+    } else if (strcmp(key, "pids") == 0 && parse_number(text, &value, "") == 0) {
+        limits->pids_max = value;
+    } else {
+        if (strcmp(key, "mem") == 0 || strcmp(key, "cpu") == 0 || strcmp(key, "pids") == 0) {
+            printf("Invalid value for %s: '%s'\n", key, text);
+        } else {
+            printf("Unknown limit: %s\n", key);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes a value into a cgroup file.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int write_cgroup_file(const char *cgroup, const char *file, const char *value) {
+    char path[MAX_LINE * 2];
+    snprintf(path, sizeof(path), "%s/%s", cgroup, file);
+
+    int fd = open(path, O_WRONLY);
+    if (fd == -1) return -1;
+    ssize_t written = write(fd, value, strlen(value));
+    close(fd);
+    return written < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Reads a number from a cgroup file, or the value of a key in a flat-keyed file.
+ *
+ * @param key The key to look for, or NULL if the file only holds a number.
+ * @return The value, or -1 if it cannot be read.
+ */
+static long read_cgroup_value(const char *cgroup, const char *file, const char *key) {
+    char path[MAX_LINE * 2];
+    char line[MAX_LINE];
+    long value = -1;
+
+    snprintf(path, sizeof(path), "%s/%s", cgroup, file);
+    FILE *stream = fopen(path, "r");
+    if (stream == NULL) return -1;
+
+    while (fgets(line, sizeof(line), stream) != NULL) {
+        if (key == NULL) {
+            value = atol(line);
+            break;
+        }
+        size_t length = strlen(key);
+        if (strncmp(line, key, length) == 0 && line[length] == ' ') {
+            value = atol(line + length + 1);
+            break;
+        }
+    }
+    fclose(stream);
+    return value;
+}
+
+/**
+ * @brief Loads the limits of the client from the environment.
+ *
+ * CLIENT_CGROUP is a cgroup v2 directory delegated to the user, in which a leaf is
+ * created for each command. CLIENT_MEMORY_MAX, CLIENT_CPU_WEIGHT and CLIENT_PIDS_MAX
+ * are the limits applied to the commands received from the server.
+ */
+void limits_load_config() {
+    char *value;
+
+    if ((value = getenv("CLIENT_CGROUP")) != NULL) {
+        snprintf(cgroup_root, sizeof(cgroup_root), "%s", value);
+        // Let the leaves use the controllers (fails harmlessly if already done or not delegated)
+        write_cgroup_file(cgroup_root, "cgroup.subtree_control", "+memory");
+        write_cgroup_file(cgroup_root, "cgroup.subtree_control", "+pids");
+        write_cgroup_file(cgroup_root, "cgroup.subtree_control", "+cpu");
+    }
+    if ((value = getenv("CLIENT_MEMORY_MAX")) != NULL && set_limit("mem", value, &default_limits) < 0) {
+        printf("CLIENT_MEMORY_MAX ignored\n");
+    }
+    if ((value = getenv("CLIENT_CPU_WEIGHT")) != NULL && set_limit("cpu", value, &default_limits) < 0) {
+        printf("CLIENT_CPU_WEIGHT ignored\n");
+    }
+    if ((value = getenv("CLIENT_PIDS_MAX")) != NULL && set_limit("pids", value, &default_limits) < 0) {
+        printf("CLIENT_PIDS_MAX ignored\n");
+    }
+}
+
+/**
+ * @brief Parses a "limit [mem=<size>] [cpu=<weight>] [pids=<n>]" prefix at the start of a command.
+ *
+ * @param command The command, advanced past the prefix if there is one.
+ * @param limits The limits to update.
+ * @return 1 if a prefix was parsed, 0 if there is none, -1 if it is invalid.
+ */
+int parse_limits(char **command, ResourceLimits *limits) {
+    char *start = *command;
+    while (*start == ' ' || *start == '\t') start++;
+
+    if (strncmp(start, "limit", 5) != 0 || (start[5] != ' ' && start[5] != '\t')) {
+        return 0;
+    }
+
+    char *position = start + 5;
+    while (1) {
+        while (*position == ' ' || *position == '\t') position++;
+
+        // Stop at the first word which is not an option
+        size_t length = strcspn(position, " \t\n");
+        char *equal = memchr(position, '=', length);
+        if (equal == NULL) break;
+
+        char key[MAX_LINE];
+        char value[MAX_LINE];
+        size_t value_length = length - (equal - position) - 1;
+        snprintf(key, sizeof(key), "%.*s", (int)(equal - position), position);
+        snprintf(value, sizeof(value), "%.*s", (int)value_length, equal + 1);
+
+        if (set_limit(key, value, limits) < 0) {
+            printf(LIMITS_USAGE);
+            return -1;
+        }
+        position += length;
+    }
+
+    *command = position;
+    return 1;
+}
+
+/**
+ * @brief Tells if a limit is set.
+ */
+int limits_enabled(ResourceLimits *limits) {
+    return limits->memory_max != 0 || limits->cpu_weight != 0 || limits->pids_max != 0;
+}
+
+/**
+ * @brief Creates the leaf cgroup of a pipeline, if a delegated subtree is configured.
+ *
+ * Without cgroup (or if the leaf cannot be created), the children fall back to rlimits.
+ */
+void limits_prepare(ResourceLimits *limits) {
+    char value[64];
+
+    limits->cgroup[0] = '\0';
+    if (cgroup_root[0] == '\0') return;
+
+    snprintf(limits->cgroup, sizeof(limits->cgroup), "%s/cmd-%d-%lu", cgroup_root, getpid(), cgroup_counter++);
+    if (mkdir(limits->cgroup, 0755) < 0) {
+        perror("cgroup mkdir error (using rlimits)");
+        limits->cgroup[0] = '\0';
+        return;
+    }
+
+    int failed = 0;
+    if (limits->memory_max != 0) {
+        snprintf(value, sizeof(value), "%lu", limits->memory_max);
+        failed |= write_cgroup_file(limits->cgroup, "memory.max", value);
+    }
+    if (limits->cpu_weight != 0) {
+        snprintf(value, sizeof(value), "%lu", limits->cpu_weight);
+        failed |= write_cgroup_file(limits->cgroup, "cpu.weight", value);
+    }
+    if (limits->pids_max != 0) {
+        snprintf(value, sizeof(value), "%lu", limits->pids_max);
+        failed |= write_cgroup_file(limits->cgroup, "pids.max", value);
+    }
+
+    // A controller is missing from the subtree: the limits would not be enforced
+    if (failed) {
+        printf("Controllers not delegated to %s, using rlimits\n", cgroup_root);
+        rmdir(limits->cgroup);
+        limits->cgroup[0] = '\0';
+    }
+}
+
+/**
+ * @brief Applies the limits in a child process, before execvp().
+ *
+ * The child joins the leaf cgroup of the pipeline, or sets its own rlimits and
+ * nice value when cgroups are not available.
+ */
+void limits_apply_child(ResourceLimits *limits) {
+    if (limits->cgroup[0] != '\0' && write_cgroup_file(limits->cgroup, "cgroup.procs", "0") == 0) {
+        return;
+    }
+
+    if (limits->memory_max != 0) {
+        struct rlimit limit = { limits->memory_max, limits->memory_max };
+        setrlimit(RLIMIT_AS, &limit);
+    }
+    if (limits->pids_max != 0) {
+        // RLIMIT_NPROC counts all the processes of the user, it is only an approximation
+        struct rlimit limit = { limits->pids_max, limits->pids_max };
+        setrlimit(RLIMIT_NPROC, &limit);
+    }
+    if (limits->cpu_weight != 0) {
+        // Each nice level changes the CPU share by about 25%, weight 100 is nice 0
+        int niceness = 0;
+        unsigned long weight = 100;
+        while (weight > limits->cpu_weight && niceness < 19) {
+            weight = weight * 4 / 5;
+            niceness++;
+        }
+        while (weight < limits->cpu_weight && niceness > -20) {
+            weight = weight * 5 / 4 + 1;
+            niceness--;
+        }
+        setpriority(PRIO_PROCESS, 0, niceness);
+    }
+}
+
+/**
+ * @brief Reads the peak usage of a finished pipeline and removes its leaf cgroup.
+ */
+void limits_finish(ResourceLimits *limits) {
+    last_command_usage.limited = 1;
+    if (limits->cgroup[0] == '\0') return;
+
+    long value = read_cgroup_value(limits->cgroup, "memory.peak", NULL);
+    if (value >= 0) {
+        last_command_usage.peak_memory_kb = value / 1024;
+    }
+    value = read_cgroup_value(limits->cgroup, "pids.peak", NULL);
+    if (value >= 0) {
+        last_command_usage.peak_pids = value;
+    }
+    value = read_cgroup_value(limits->cgroup, "cpu.stat", "usage_usec");
+    if (value >= 0) {
+        last_command_usage.cpu_seconds = value / 1000000.0;
+    }
+
+    // Fails if a background process is still inside, the leaf is then left behind
+    rmdir(limits->cgroup);
+    limits->cgroup[0] = '\0';
+}
+
+/**
+ * @brief Adds the resources used by a child that was just waited for.
+ */
+void account_child(struct rusage *usage) {
+    last_command_usage.cpu_seconds += usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1000000.0
+                                    + usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1000000.0;
+    if (usage->ru_maxrss > last_command_usage.peak_memory_kb) {
+        last_command_usage.peak_memory_kb = usage->ru_maxrss;
+    }
+}
+
+/**
+ * @brief Formats the resources used by the last command, to be sent to the server.
+ */
+void format_usage(char *buffer, size_t size) {
+    int length = snprintf(buffer, size, "peak memory %ld KB, cpu %.2f s",
+                          last_command_usage.peak_memory_kb, last_command_usage.cpu_seconds);
+    if (last_command_usage.peak_pids >= 0 && length >= 0 && (size_t)length < size) {
+        snprintf(buffer + length, size - length, ", peak pids %ld", last_command_usage.peak_pids);
+    }
+}
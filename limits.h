@@ -0,0 +1,38 @@
+#ifndef LIMITS_H
+#define LIMITS_H
+
+#include "shell.h"
+#include <sys/resource.h>
+
+#define CPU_WEIGHT_MAX 10000  // Highest cpu.weight accepted by the kernel
+
+// Resource limits of a pipeline (0 means no limit)
+typedef struct {
+    unsigned long memory_max;   // Bytes (memory.max, or RLIMIT_AS without cgroups)
+    unsigned long cpu_weight;   // 1-10000, 100 is the default weight (cpu.weight, or nice)
+    unsigned long pids_max;     // Processes (pids.max, or RLIMIT_NPROC without cgroups)
+    char cgroup[MAX_LINE];      // Leaf cgroup of the pipeline (empty if rlimits are used)
+} ResourceLimits;
+
+// Resources used by the last command
+typedef struct {
+    long peak_memory_kb;
+    double cpu_seconds;
+    long peak_pids;             // -1 if unknown
+    int limited;                // 1 if the command ran with resource limits
+} CommandUsage;
+
+extern ResourceLimits default_limits;
+extern int use_default_limits;
+extern CommandUsage last_command_usage;
+
+void limits_load_config();
+int parse_limits(char **command, ResourceLimits *limits);
+int limits_enabled(ResourceLimits *limits);
+void limits_prepare(ResourceLimits *limits);
+void limits_apply_child(ResourceLimits *limits);
+void limits_finish(ResourceLimits *limits);
+void account_child(struct rusage *usage);
+void format_usage(char *buffer, size_t size);
+
+#endif
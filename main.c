@@ -1,6 +1,9 @@
 #include "shell.h"
 #include "server.h"
 #include "client.h"
+#include "client_pool.h"
+#include "trace.h"
+#include "zygote.h"
 
 /**
  * @brief Entry point for the application.
@@ -22,8 +25,11 @@ int main(int argc, char *argv[]) {
 
     int port = 0;
 
+    // Optional tracing of the commands (TRACE_FILE=<file.json>)
+    trace_init(argv[1]);
+
     // Check if a port is provided
-    if (argc == 3) {
+    if (argc >= 3) {
         port = atoi(argv[2]);  // Convert the given port argument
     }
 
@@ -54,7 +60,25 @@ int main(int argc, char *argv[]) {
             printf("Please specify a port for the multi_server (>1234).\n");
             return 1;
         }
-        multi_server(port);
+        // Optional memory limits, in KB: total budget and cap per client
+        size_t memory_budget = DEFAULT_MEMORY_BUDGET;
+        size_t client_cap = DEFAULT_CLIENT_CAP;
+        if (argc >= 4) {
+            memory_budget = strtoul(argv[3], NULL, 10) * 1024;
+        }
+        if (argc >= 5) {
+            client_cap = strtoul(argv[4], NULL, 10) * 1024;
+        }
+        multi_server(port, memory_budget, client_cap);
+    }
+    else if (strcmp(argv[1], "zygote_bench") == 0) {
+        // Compare the latency of a command started with fork() and by a zygote helper
+        if (argc < 5) {
+            printf("Usage: %s zygote_bench <runs> <client memory in MB> <command>\n", argv[0]);
+            return 1;
+        }
+        int runs = atoi(argv[2]);
+        zygote_bench(runs > 0 ? runs : 1, strtoul(argv[3], NULL, 10), argv[4]);
     }
     else {
         // If an unknown argument is provided
@@ -0,0 +1,303 @@
+#include "shell.h"
+#include "client.h"
+#include "map.h"
+
+/**
+ * @brief Counts the clients currently connected.
+ */
+static int map_count_clients(ClientInfo *clients) {
+    int count = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].socket_fd > 0) count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Puts an item back at the end of the pending queue.
+ */
+static void map_enqueue(MapJob *job, int index) {
+    job->queue[(job->queue_head + job->queue_len) % job->num_items] = index;
+    job->queue_len++;
+    job->items[index].state = MAP_PENDING;
+}
+
+/**
+ * @brief Takes the first item of the pending queue.
+ */
+static int map_dequeue(MapJob *job) {
+    int index = job->queue[job->queue_head];
+    job->queue_head = (job->queue_head + 1) % job->num_items;
+    job->queue_len--;
+    return index;
+}
+
+/**
+ * @brief Prints the result of a finished item.
+ */
+static void map_print_item(MapJob *job, int index) {
+    MapItem *item = &job->items[index];
+    char command[MAX_LINE];
+
+    if (substitute_item(job->template, item->input, command, sizeof(command)) < 0) {
+        snprintf(command, sizeof(command), "%s", item->input);
+    }
+
+    if (item->state == MAP_DONE) {
+        printf("[map %d/%d] client %d: ok -> %s\n",
+               index + 1, job->num_items, item->last_client, command);
+    } else {
+        printf("[map %d/%d] client %d: FAILED (status %d after %d attempt(s)) -> %s\n",
+               index + 1, job->num_items, item->last_client, item->status, item->attempts, command);
+    }
+}
+
+/**
+ * @brief Frees the memory used by a job and marks it as inactive.
+ */
+static void map_free(MapJob *job) {
+    for (int i = 0; i < job->num_items; i++) {
+        free(job->items[i].input);
+    }
+    free(job->items);
+    free(job->queue);
+    job->items = NULL;
+    job->queue = NULL;
+    job->num_items = 0;
+    job->active = 0;
+}
+
+/**
+ * @brief Records the end of an item, prints the results and ends the job when everything is done.
+ */
+static void map_complete(MapJob *job, int index) {
+    job->completed++;
+
+    if (job->ordered) {
+        // Only print once every previous item has finished
+        while (job->next_to_print < job->num_items &&
+               (job->items[job->next_to_print].state == MAP_DONE ||
+                job->items[job->next_to_print].state == MAP_FAILED)) {
+            map_print_item(job, job->next_to_print++);
+        }
+    } else {
+        map_print_item(job, index);
+    }
+
+    if (job->completed == job->num_items) {
+        int failed = 0;
+        for (int i = 0; i < job->num_items; i++) {
+            if (job->items[i].state == MAP_FAILED) failed++;
+        }
+        printf("\nMap finished: %d item(s) succeeded, %d failed.\n", job->num_items - failed, failed);
+        map_free(job);
+    }
+}
+
+/**
+ * @brief Handles an item that failed or was lost: retries it or marks it as failed.
+ */
+static void map_retry_or_fail(MapJob *job, int index, int status) {
+    MapItem *item = &job->items[index];
+    item->status = status;
+
+    if (item->attempts < MAP_MAX_ATTEMPTS) {
+        map_enqueue(job, index);
+    } else {
+        item->state = MAP_FAILED;
+        map_complete(job, index);
+    }
+}
+
+/**
+ * @brief Starts a -map job: reads the input file and prepares the items.
+ *
+ * The expected arguments are "<file> <command with {}> [-ordered]".
+ *
+ * @param job The job to initialize.
+ * @param args The arguments following '-map' on the console.
+ * @return 0 on success, -1 on error.
+ */
+int map_start(MapJob *job, char *args) {
+    char *saveptr;
+    char *filename = strtok_r(args, " \t", &saveptr);
+    char *template = strtok_r(NULL, "", &saveptr);
+
+    if (filename == NULL || template == NULL) {
+        printf("Usage: -map <file> <command with {}> [-ordered]\n");
+        return -1;
+    }
+
+    // Check for the '-ordered' option at the end of the template
+    job->ordered = 0;
+    char *ordered_flag = strstr(template, "-ordered");
+    if (ordered_flag != NULL && ordered_flag[strlen("-ordered")] == '\0') {
+        job->ordered = 1;
+        *ordered_flag = '\0';
+    }
+    while (*template == ' ') template++;
+    size_t length = strlen(template);
+    while (length > 0 && template[length - 1] == ' ') {
+        template[--length] = '\0';  // Remove trailing spaces
+    }
+    if (length == 0) {
+        printf("Usage: -map <file> <command with {}> [-ordered]\n");
+        return -1;
+    }
+    snprintf(job->template, sizeof(job->template), "%s", template);
+
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        perror("fopen error");
+        return -1;
+    }
+
+    // Read the input lines, growing the array as needed
+    char line[MAX_LINE];
+    int capacity = 64;
+    job->items = malloc(capacity * sizeof(MapItem));
+    job->num_items = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0') continue;  // Skip empty lines
+
+        if (job->num_items == capacity) {
+            capacity *= 2;
+            job->items = realloc(job->items, capacity * sizeof(MapItem));
+        }
+        MapItem *item = &job->items[job->num_items++];
+        item->input = strdup(line);
+        item->state = MAP_PENDING;
+        item->attempts = 0;
+        item->last_client = -1;
+        item->status = -1;
+    }
+    fclose(file);
+
+    if (job->num_items == 0) {
+        printf("No input in %s, nothing to do.\n", filename);
+        map_free(job);
+        return -1;
+    }
+
+    // Every item starts in the pending queue, in input order
+    job->queue = malloc(job->num_items * sizeof(int));
+    job->queue_head = 0;
+    job->queue_len = 0;
+    for (int i = 0; i < job->num_items; i++) {
+        map_enqueue(job, i);
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        job->inflight[i] = -1;
+    }
+    job->completed = 0;
+    job->next_to_print = 0;
+    job->active = 1;
+
+    printf("Map started: %d item(s) from %s%s\n", job->num_items, filename,
+           job->ordered ? " (ordered output)" : "");
+    return 0;
+}
+
+/**
+ * @brief Sends a pending item to every idle client.
+ *
+ * Clients pull a new item as soon as they answer, so faster clients naturally take
+ * more of the work. A retried item is not given back to the client where it failed
+ * unless it is the only one connected.
+ *
+ * @param job The running job.
+ * @param clients The array of connected clients.
+ */
+void map_dispatch(MapJob *job, ClientInfo *clients) {
+    if (!job->active) return;
+
+    for (int i = 0; i < MAX_CLIENTS && job->queue_len > 0; i++) {
+        int sock = clients[i].socket_fd;
+        // A client still running commands of the console would answer them first
+        if (sock <= 0 || job->inflight[i] != -1 || clients[i].commands_pending > 0) continue;
+
+        // Look for an item that did not already fail on this client
+        int index = map_dequeue(job);
+        int tries = job->queue_len;
+        while (job->items[index].last_client == sock && tries-- > 0 && map_count_clients(clients) > 1) {
+            map_enqueue(job, index);
+            index = map_dequeue(job);
+        }
+
+        MapItem *item = &job->items[index];
+        char command[MAX_LINE];
+        if (substitute_item(job->template, item->input, command, sizeof(command)) < 0) {
+            printf("Command too long for item %d, skipped.\n", index + 1);
+            item->attempts = MAP_MAX_ATTEMPTS;
+            item->state = MAP_FAILED;
+            map_complete(job, index);
+            if (!job->active) return;
+            i--;  // The client is still idle
+            continue;
+        }
+
+        item->attempts++;
+        item->last_client = sock;
+        trace_set_id(trace_new_id());  // Each item is a trace of its own
+        if (client_send_command(&clients[i], FRAME_COMMAND, command, strlen(command) + 1) == -1) {
+            client_detach(&clients[i]);
+            item->attempts--;  // Not the item's fault
+            map_enqueue(job, index);
+            continue;
+        }
+        output_record(&clients[i].output, "$", command);
+        item->state = MAP_RUNNING;
+        job->inflight[i] = index;
+    }
+}
+
+/**
+ * @brief Handles the response of a client that may be running an item.
+ *
+ * @param job The running job.
+ * @param clients The array of connected clients.
+ * @param slot The index of the client in the array.
+ * @param response The response received from the client.
+ * @return 1 if the response belonged to the job, 0 otherwise.
+ */
+int map_handle_response(MapJob *job, ClientInfo *clients, int slot, const char *response) {
+    if (!job->active || job->inflight[slot] == -1) return 0;
+
+    int index = job->inflight[slot];
+    job->inflight[slot] = -1;
+
+    if (strncmp(response, CLIENT_SUCCESS_RESPONSE, strlen(CLIENT_SUCCESS_RESPONSE)) == 0) {
+        job->items[index].status = 0;
+        job->items[index].state = MAP_DONE;
+        map_complete(job, index);
+    } else {
+        int status = -1;
+        if (strncmp(response, CLIENT_FAILURE_RESPONSE, strlen(CLIENT_FAILURE_RESPONSE)) == 0) {
+            status = atoi(response + strlen(CLIENT_FAILURE_RESPONSE));
+        }
+        else if (strncmp(response, CLIENT_TIMEOUT_RESPONSE, strlen(CLIENT_TIMEOUT_RESPONSE)) == 0) {
+            status = atoi(response + strlen(CLIENT_TIMEOUT_RESPONSE));
+        }
+        map_retry_or_fail(job, index, status);
+    }
+
+    map_dispatch(job, clients);
+    return 1;
+}
+
+/**
+ * @brief Gives the item of a disconnected client to another client.
+ *
+ * @param job The running job.
+ * @param clients The array of connected clients.
+ * @param slot The index of the client that disconnected.
+ */
+void map_handle_disconnect(MapJob *job, ClientInfo *clients, int slot) {
+    if (!job->active || job->inflight[slot] == -1) return;
+
+    int index = job->inflight[slot];
+    job->inflight[slot] = -1;
+    map_retry_or_fail(job, index, -1);
+    map_dispatch(job, clients);
+}
@@ -0,0 +1,46 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include "server.h"
+#include "client_pool.h"
+
+#define MAP_MAX_ATTEMPTS 3  // Number of tries before an item is reported as failed
+
+// State of a single input line of a -map job
+typedef enum {
+    MAP_PENDING,
+    MAP_RUNNING,
+    MAP_DONE,
+    MAP_FAILED
+} MapState;
+
+// One input line and the bookkeeping needed to retry it elsewhere
+typedef struct {
+    char *input;       // Line read from the input file
+    MapState state;
+    int attempts;      // Number of times the item has been sent
+    int last_client;   // Socket of the client that ran it last (-1 if never sent)
+    int status;        // Exit status reported by the client (-1 if lost)
+} MapItem;
+
+// A -map job distributed over the connected clients
+typedef struct {
+    int active;                    // 1 while a job is running
+    int ordered;                   // 1 to print results in input order
+    char template[MAX_LINE];       // Command template, '{}' is replaced by the item
+    MapItem *items;
+    int num_items;
+    int *queue;                    // Circular queue of pending item indexes
+    int queue_head;
+    int queue_len;
+    int inflight[MAX_CLIENTS];     // Item running on each client slot (-1 if idle)
+    int completed;                 // Number of items done or failed
+    int next_to_print;             // Next item to print in ordered mode
+} MapJob;
+
+int map_start(MapJob *job, char *args);
+void map_dispatch(MapJob *job, ClientInfo *clients);
+int map_handle_response(MapJob *job, ClientInfo *clients, int slot, const char *response);
+void map_handle_disconnect(MapJob *job, ClientInfo *clients, int slot);
+
+#endif
@@ -1,25 +1,155 @@
 #include "shell.h"
 #include "server.h"
+#include "map.h"
+#include "client_pool.h"
+#include "script.h"
+#include "transfer.h"
+#include "console.h"
+#include "timer_wheel.h"
+#include "session.h"
 
-typedef struct {
-    int socket_fd;
-    struct sockaddr_in address;
-} ClientInfo;
+// One slot more than MAX_CLIENTS: when every slot is taken (some by lost clients),
+// it holds a new connection just long enough for it to resume its session
+#define CLIENT_SLOTS (MAX_CLIENTS + 1)
+#define RESUME_SLOT MAX_CLIENTS
+
+static Timer heartbeat_timer;  // Pings every client once per interval
+static int heartbeat_expired = 0;  // Clients that missed too many pings, evicted by the main loop
+
+/**
+ * @brief Handles a client whose connection is lost: its slot waits for it to reconnect, or is freed.
+ *
+ * Either way its -map item goes back to the queue at once, so the job does not
+ * wait for the end of the grace window.
+ */
+static void lose_client(ClientInfo *clients, int slot, MapJob *map_job) {
+    int sock = clients[slot].socket_fd;
+    if (session_suspend(&clients[slot]) == 0) {
+        printf("Session of client socket %d kept for %ld ms in case it reconnects\n", sock, session_grace_ms);
+    } 
+    else {
+        client_detach(&clients[slot]);
+    }
+    map_handle_disconnect(map_job, clients, slot);
+}
+
+/**
+ * @brief Pings the clients, then sets the timer again for the next interval.
+ */
+static void heartbeat_tick(Timer *timer) {
+    heartbeat_expired += clients_heartbeat(timer->data, MAX_CLIENTS);
+    timer_add(timer, heartbeat_interval_ms);
+}
+
+/**
+ * @brief Finds a connected client from the number of its socket.
+ *
+ * @return The client, or NULL (with a message) if there is none.
+ */
+static ClientInfo *find_client(ClientInfo *clients, const char *id) {
+    int target_fd = id != NULL ? atoi(id) : 0;
+    for (int i = 0; i < MAX_CLIENTS && target_fd > 0; i++) {
+        if (clients[i].socket_fd == target_fd) {
+            return &clients[i];
+        }
+    }
+    printf("No client with socket %s\n", id != NULL ? id : "(missing)");
+    return NULL;
+}
+
+/**
+ * @brief Shows the output kept for a client: "tail -id <x> [lines]" or "grep -id <x> <pattern>".
+ *
+ * @param args The arguments following "-id".
+ * @param clients The array of connected clients.
+ * @param grep 1 for grep, 0 for tail.
+ */
+static void show_output(char *args, ClientInfo *clients, int grep) {
+    char *saveptr;
+    char *id = strtok_r(args, " \t", &saveptr);
+    char *rest = strtok_r(NULL, "", &saveptr);
+    ClientInfo *client = find_client(clients, id);
+    if (client == NULL) return;
+
+    printf("\n");
+    if (grep) {
+        if (rest == NULL) {
+            printf("Usage: grep -id <x> <pattern>\n");
+            return;
+        }
+        if (output_grep(&client->output, rest) == 0) {
+            printf("No match in the output of client socket %d\n", client->socket_fd);
+        }
+    } else {
+        int lines = rest != NULL ? atoi(rest) : OUTPUT_TAIL_LINES;
+        output_tail(&client->output, lines > 0 ? lines : OUTPUT_TAIL_LINES);
+    }
+}
+
+/**
+ * @brief Sends a script to the clients given after its file name, in a single frame per client.
+ *
+ * The expected arguments are "<file> -all" or "<file> -id <x> [<y> ...]".
+ *
+ * @param args The arguments following '-script' on the console.
+ * @param clients The array of connected clients.
+ * @param map_job The -map job, told about the clients lost while sending.
+ */
+static void send_script(char *args, ClientInfo *clients, MapJob *map_job) {
+    char *saveptr;
+    char *filename = strtok_r(args, " \t", &saveptr);
+    char *target = strtok_r(NULL, "", &saveptr);
+    int slots[MAX_CLIENTS];  // Slots of the targeted clients
+    int num_targets = client_select(clients, MAX_CLIENTS, target, slots);
+
+    if (filename == NULL || num_targets < 0) {
+        printf("Usage: -script <file> -all | -script <file> -id <x> [<y> ...]\n");
+        return;
+    }
+
+    size_t length;
+    char *script = read_script(filename, &length);
+    if (script == NULL) return;
+    if (length + 1 > MAX_FRAME_SIZE) {
+        printf("Script too large (maximum %d bytes)\n", MAX_FRAME_SIZE);
+        free(script);
+        return;
+    }
+
+    for (int k = 0; k < num_targets; k++) {
+        int i = slots[k];
+        int sock = clients[i].socket_fd;
+        if (client_send_command(&clients[i], FRAME_SCRIPT, script, length + 1) == -1) {
+            client_detach(&clients[i]);
+            map_handle_disconnect(map_job, clients, i);
+        } 
+        else {
+            output_record(&clients[i].output, "$ -script", filename);
+            printf("Script %s sent to client socket %d (%zu bytes)\n", filename, sock, length);
+        }
+    }
+    free(script);
+}
 
 /**
  * @brief Starts the multi-client server on the specified port.
  * 
  * The server listens for incoming client connections and handles
  * multiple clients concurrently. Commands can be executed locally
- * or sent to specific/all clients.
+ * or sent to specific/all clients. The buffers of the clients come from
+ * an arena reserved at startup, so the memory used by the server is bounded.
  *
  * @param port The port number on which the server will listen.
+ * @param memory_budget The memory shared by all the clients, in bytes.
+ * @param client_cap The memory a single client may hold, in bytes.
  */
-void multi_server(int port) {
+void multi_server(int port, size_t memory_budget, size_t client_cap) {
     char buffer[MAX_LINE] = {0};
     int fd_server, new_socket;
     int opt = 1;
-    ClientInfo client_sockets[MAX_CLIENTS] = {0};  // Array to store client information
+    ClientInfo client_sockets[CLIENT_SLOTS] = {0};  // Array to store client information
+    MapJob map_job = {0};  // Current -map job, if any
+    Arena arena;  // Memory shared by the buffers of the clients
     struct sockaddr_in address;
     int addrlen = sizeof(address);
 
@@ -27,6 +157,20 @@ void multi_server(int port) {
     signal(SIGINT, handle_sigint);
     signal(SIGTSTP, handle_sigtstp);
     signal(SIGTERM, handle_sigterm);
+    console_init(server_commands, client_sockets, MAX_CLIENTS);
+
+    if (arena_init(&arena, memory_budget) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    // A single timer drives the heartbeats of all the clients
+    heartbeat_load_config();
+    session_load_config();
+    if (heartbeat_interval_ms > 0) {
+        heartbeat_timer.callback = heartbeat_tick;
+        heartbeat_timer.data = client_sockets;
+        timer_add(&heartbeat_timer, heartbeat_interval_ms);
+    }
 
     // Create server socket
     if ((fd_server = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
@@ -61,36 +205,85 @@ void multi_server(int port) {
     }
 
     fd_set readfds;
+    fd_set writefds;
     int max_fd = fd_server;
 
+    int show_prompt = 1;
     while (1) {
-        printf("\nMulti-client server waiting for connections (PORT: %d)...\n", port);
-        printf("\n%s> ", get_path());
-        fflush(stdout);
+        if (show_prompt) {
+            char prompt[MAX_LINE + 3];
+            snprintf(prompt, sizeof(prompt), "%s> ", get_path());
+            printf("\nMulti-client server waiting for connections (PORT: %d)...\n\n", port);
+            console_prompt(prompt);
+        }
 
         FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
         FD_SET(fd_server, &readfds);
         FD_SET(STDIN_FILENO, &readfds);
 
-        // Add existing client sockets to the set
-        for (int i = 0; i < MAX_CLIENTS; i++) {
+        // Add existing client sockets to the set, and wait for the ones with pending output to be writable
+        for (int i = 0; i < CLIENT_SLOTS; i++) {
             int socket = client_sockets[i].socket_fd;
             if (socket > 0) {
                 FD_SET(socket, &readfds);
+                if (client_sockets[i].out_head != NULL || transfer_wants_write(&client_sockets[i])) {
+                    FD_SET(socket, &writefds);
+                }
             }
             if (socket > max_fd) {
                 max_fd = socket;
             }
         }
 
+        // Monitor the timers (heartbeats, and background commands started with 'timeout')
+        int timer_fd = timer_wheel_fd();
+        if (timer_fd != -1) {
+            FD_SET(timer_fd, &readfds);
+            if (timer_fd > max_fd) max_fd = timer_fd;
+        }
+
         // Monitor sockets for activity
-        int activity = select(max_fd + 1, &readfds, NULL, NULL, NULL);
+        int activity = select(max_fd + 1, &readfds, &writefds, NULL, NULL);
 
         if (activity < 0 && errno != EINTR) {
             perror("select error");
             continue;
         }
 
+        // Chunks of a file moving in the background keep the current prompt
+        show_prompt = FD_ISSET(fd_server, &readfds) || FD_ISSET(STDIN_FILENO, &readfds);
+
+        // Evict the clients that stopped answering the pings, freeing their buffers,
+        // and free the slots of the lost clients that did not come back in time
+        if (timer_fd != -1 && FD_ISSET(timer_fd, &readfds)) {
+            timer_wheel_process();
+            for (int i = 0; i < CLIENT_SLOTS; i++) {
+                if (i == RESUME_SLOT && client_sockets[i].socket_fd > 0 && client_sockets[i].session_expired) {
+                    printf("\nMaximum number of clients reached. Closing connection: %d\n", client_sockets[i].socket_fd);
+                    client_detach(&client_sockets[i]);
+                }
+                else if (client_sockets[i].socket_fd == -1 && client_sockets[i].session_expired) {
+                    show_prompt = 1;
+                    printf("\nClient %s:%d did not reconnect, its session ended\n",
+                           inet_ntoa(client_sockets[i].address.sin_addr), ntohs(client_sockets[i].address.sin_port));
+                    client_detach(&client_sockets[i]);
+                    map_handle_disconnect(&map_job, client_sockets, i);
+                }
+            }
+        }
+        if (heartbeat_expired > 0) {
+            for (int i = 0; i < MAX_CLIENTS; i++) {
+                if (client_sockets[i].socket_fd > 0 && client_sockets[i].heartbeat.missed >= heartbeat_max_missed) {
+                    show_prompt = 1;
+                    printf("\nClient socket %d missed %d heartbeats, evicted\n",
+                           client_sockets[i].socket_fd, client_sockets[i].heartbeat.missed);
+                    lose_client(client_sockets, i, &map_job);
+                }
+            }
+            heartbeat_expired = 0;
+        }
+
         // Check for new client connections
         if (FD_ISSET(fd_server, &readfds)) {
             if ((new_socket = accept(fd_server, (struct sockaddr *)&address, (socklen_t *)&addrlen)) < 0) {
@@ -104,23 +297,54 @@ void multi_server(int port) {
             int added = 0;
             for (int i = 0; i < MAX_CLIENTS; i++) {
                 if (client_sockets[i].socket_fd == 0) {
-                    client_sockets[i].socket_fd = new_socket;
-                    client_sockets[i].address = address;
-                    added = 1;
+                    if (client_attach(&client_sockets[i], &arena, client_cap, new_socket, &address) == 0) {
+                        session_open(&client_sockets[i]);
+                        added = 1;
+                    } else {
+                        printf("Memory budget of the server reached. Closing connection: %d\n", new_socket);
+                        added = -1;
+                    }
                     break;
                 }
             }
 
-            if (!added) {
+            // Every slot is taken, but a lost client may be coming back to its own
+            int waiting = 0;
+            for (int i = 0; i < MAX_CLIENTS; i++) {
+                if (client_sockets[i].socket_fd == -1) waiting = 1;
+            }
+            if (added == 0 && waiting && client_sockets[RESUME_SLOT].socket_fd == 0) {
+                if (client_attach(&client_sockets[RESUME_SLOT], &arena, client_cap, new_socket, &address) == 0) {
+                    session_await_resume(&client_sockets[RESUME_SLOT]);
+                    added = 1;
+                } else {
+                    added = -1;
+                }
+            }
+            if (added == 0) {
                 printf("Maximum number of clients reached. Closing connection: %d\n", new_socket);
+            }
+            if (added != 1) {
                 close(new_socket);
             }
+
+            // A new client can immediately take part in a running -map job
+            map_dispatch(&map_job, client_sockets);
         }
 
         // Check if a command was entered via the server console
         if (FD_ISSET(STDIN_FILENO, &readfds)) {
-            memset(buffer, 0, MAX_LINE + 1);
-            if (fgets(buffer, MAX_LINE, stdin) != NULL) {
+            // Everything done for this line belongs to a new trace
+            long long console_start = TRACE_START();
+            if (console_start != 0) {
+                trace_set_id(trace_new_id());
+            }
+            memset(buffer, 0, sizeof(buffer));
+            int ready = console_line_ready(buffer, MAX_LINE);
+            if (ready == 0) {
+                show_prompt = FD_ISSET(fd_server, &readfds);  // Only part of a line was typed
+            }
+            if (ready == 1) {
                 buffer[strcspn(buffer, "\n")] = 0;  // Remove newline character
 
                 if (strlen(buffer) > 0) {
@@ -134,13 +358,62 @@ void multi_server(int port) {
                         // Notify clients about server shutdown and exit
                         exit_server();
                     } 
+                    else if (strncmp(buffer, "-map ", 5) == 0) {
+                        // Distribute a command over the lines of a file
+                        if (map_job.active) {
+                            printf("A -map job is already running.\n");
+                        }
+                        else {
+                            char args[MAX_LINE];
+                            snprintf(args, sizeof(args), "%s", buffer + 5);
+                            if (map_start(&map_job, args) == 0) {
+                                map_dispatch(&map_job, client_sockets);
+                                if (map_job.active && map_job.queue_len == map_job.num_items) {
+                                    printf("No client connected, items will be sent when a client connects.\n");
+                                }
+                            }
+                        }
+                    }
+                    else if (strncmp(buffer, "-script ", 8) == 0) {
+                        // Send a whole script in one frame, the client answers once
+                        char args[MAX_LINE];
+                        snprintf(args, sizeof(args), "%s", buffer + 8);
+                        send_script(args, client_sockets, &map_job);
+                    }
+                    else if (strncmp(buffer, "push ", 5) == 0 || strncmp(buffer, "pull ", 5) == 0) {
+                        // Copy a file to clients or from them, in chunks of data frames
+                        char args[MAX_LINE];
+                        snprintf(args, sizeof(args), "%s", buffer + 5);
+                        if (strncmp(buffer, "push ", 5) == 0) {
+                            transfer_push(args, client_sockets, &map_job);
+                        } else {
+                            transfer_pull(args, client_sockets, &map_job);
+                        }
+                    }
+                    else if (strncmp(buffer, "tail -id ", 9) == 0 || strncmp(buffer, "grep -id ", 9) == 0) {
+                        // Output of a client kept by the server (recent in memory, older in its log)
+                        char args[MAX_LINE];
+                        snprintf(args, sizeof(args), "%s", buffer + 9);
+                        show_output(args, client_sockets, buffer[0] == 'g');
+                    }
+                    else if (strcmp(buffer, "memory_stats") == 0) {
+                        // Display the usage of the memory budget
+                        print_memory_stats(&arena, client_sockets, MAX_CLIENTS);
+                    }
                     else if (strcmp(buffer, "list_clients") == 0) {
                         // List all connected clients
                         printf("\nList of connected clients:\n");
                         for (int i = 0; i < MAX_CLIENTS; i++) {
                             if (client_sockets[i].socket_fd > 0) {
-                                printf("Client socket fd: %d, IP: %s, PORT: %d\n",
+                                char rtt[128];
+                                heartbeat_format(&client_sockets[i].heartbeat, rtt, sizeof(rtt));
+                                printf("Client socket fd: %d, IP: %s, PORT: %d, %s\n",
                                        client_sockets[i].socket_fd,
+                                       inet_ntoa(client_sockets[i].address.sin_addr),
+                                       ntohs(client_sockets[i].address.sin_port), rtt);
+                            }
+                            else if (client_sockets[i].socket_fd == -1) {
+                                printf("Client %s:%d: connection lost, waiting for it to reconnect\n",
                                        inet_ntoa(client_sockets[i].address.sin_addr),
                                        ntohs(client_sockets[i].address.sin_port));
                             }
@@ -169,12 +442,12 @@ void multi_server(int port) {
                             for (int i = 0; i < MAX_CLIENTS; i++) {
                                 int sock = client_sockets[i].socket_fd;
                                 if (sock > 0) {
-                                    if (send(sock, buffer, strlen(buffer) + 1, 0) == -1) {
-                                        perror("send error");
-                                        close(sock);
-                                        client_sockets[i].socket_fd = 0;
+                                    if (client_send_command(&client_sockets[i], FRAME_COMMAND, buffer, strlen(buffer) + 1) == -1) {
+                                        client_detach(&client_sockets[i]);
+                                        map_handle_disconnect(&map_job, client_sockets, i);
                                     } 
                                     else {
+                                        output_record(&client_sockets[i].output, "$", buffer);
                                         printf("Command sent to client socket %d: %s\n", sock, buffer);
                                     }
                                 }
@@ -190,11 +463,11 @@ void multi_server(int port) {
                                         int target_fd = atoi(token);
                                         for (int i = 0; i < MAX_CLIENTS; i++) {
                                             if (client_sockets[i].socket_fd == target_fd) {
-                                                if (send(target_fd, buffer, strlen(buffer) + 1, 0) == -1) {
-                                                    perror("send error");
-                                                    close(target_fd);
-                                                    client_sockets[i].socket_fd = 0;
+                                                if (client_send_command(&client_sockets[i], FRAME_COMMAND, buffer, strlen(buffer) + 1) == -1) {
+                                                    client_detach(&client_sockets[i]);
+                                                    map_handle_disconnect(&map_job, client_sockets, i);
                                                 } else {
+                                                    output_record(&client_sockets[i].output, "$", buffer);
                                                     printf("Command sent to client socket %d: %s\n", target_fd, buffer);
                                                 }
                                             }
@@ -212,39 +485,126 @@ void multi_server(int port) {
                     add_to_history(buffer);
                 }
             }
+            TRACE_END("console", console_start);
+            trace_set_id(0);
+            trace_flush();
         }
 
-        // Handle responses from clients
-        for (int i = 0; i < MAX_CLIENTS; i++) {
+        // Send the pending output of the clients that became writable
+        for (int i = 0; i < CLIENT_SLOTS; i++) {
             int sock = client_sockets[i].socket_fd;
+            if (sock > 0 && FD_ISSET(sock, &writefds)) {
+                if (client_flush(&client_sockets[i]) == -1 || transfer_send_pending(&client_sockets[i]) == -1) {
+                    show_prompt = 1;
+                    lose_client(client_sockets, i, &map_job);
+                }
+            }
+        }
+
+        // Handle responses from clients, each one is read into the input buffer of its client
+        for (int i = 0; i < CLIENT_SLOTS; i++) {
+            ClientInfo *client = &client_sockets[i];
+            int sock = client->socket_fd;
             if (sock > 0 && FD_ISSET(sock, &readfds)) {
-                memset(buffer, 0, MAX_LINE);
-                int valread = read(sock, buffer, MAX_LINE);
+                int valread = client_receive(client);
                 if (valread > 0) {
-                    // Print response from the client
-                    printf("\nResponse from client socket %d: %s\n", sock, buffer);
+                    // A read may hold several responses, or only a part of one
+                    Frame frame;
+                    int result = 0;
+                    while (client->socket_fd > 0 && (result = client_next_frame(client, &frame)) == 1) {
+                        if (frame.type == FRAME_RESUME) {
+                            // A lost client is back: its connection moves to its old slot
+                            unsigned long lost = 0;
+                            int slot = session_resume(client_sockets, MAX_CLIENTS, client, frame.payload, &lost);
+                            show_prompt = 1;
+                            if (slot == -1 && i == RESUME_SLOT) {
+                                printf("\nMaximum number of clients reached. Closing connection: %d\n", sock);
+                                client_detach(client);
+                                continue;
+                            }
+                            if (slot == -1) {
+                                printf("\nClient socket %d could not resume its session (expired), it starts a new one\n", sock);
+                                continue;
+                            }
+                            printf("\nClient socket %d resumed its session\n", sock);
+                            FD_CLR(sock, &readfds);  // Read again through its slot on the next wakeup
+                            if (lost > 0) {
+                                printf("%lu command(s) sent before the connection was lost never reached it\n", lost);
+                            }
+                            map_dispatch(&map_job, client_sockets);  // Its -map item was requeued, it may take a new one
+                            continue;
+                        }
+                        if (i == RESUME_SLOT) {
+                            // The spare slot is only for clients coming back
+                            printf("\nMaximum number of clients reached. Closing connection: %d\n", sock);
+                            client_detach(client);
+                            continue;
+                        }
+                        if (frame.type == FRAME_CLOSE) {
+                            client->session[0] = '\0';  // Leaving for good, nothing to wait for
+                            continue;
+                        }
+                        if (frame.type == FRAME_RESPONSE) {
+                            client->responses_received++;
+                        }
+                        if (frame.type == FRAME_PONG) {
+                            // Heartbeats keep the current prompt
+                            heartbeat_pong(&client->heartbeat, frame.payload);
+                            continue;
+                        }
+                        int transfer_frame = transfer_handle_frame(client, &frame);
+                        if (!transfer_frame || frame.type != FRAME_DATA || client->transfer == NULL) {
+                            show_prompt = 1;
+                        }
+                        if (transfer_frame) continue;
+                        if (frame.type != FRAME_RESPONSE) continue;
+                        output_record(&client->output, "", frame.payload);
+                        if (client->commands_pending > 0) {
+                            client->commands_pending--;
+                        }
+
+                        // Round trip of the command, in the trace it was sent with
+                        if (client->trace_sent != 0) {
+                            trace_set_id(client->trace_id);
+                            TRACE_END("response", client->trace_sent);
+                            client->trace_sent = 0;
+                        }
+
+                        // Responses to -map items are handled by the job, the others are printed
+                        if (!map_handle_response(&map_job, client_sockets, i, frame.payload)) {
+                            printf("\nResponse from client socket %d: %s\n", sock, frame.payload);
+                            map_dispatch(&map_job, client_sockets);  // The client may be idle again
+                        }
+                    }
+                    if (result < 0) {
+                        show_prompt = 1;
+                        client_detach(client);
+                        map_handle_disconnect(&map_job, client_sockets, i);
+                    }
+                    trace_set_id(0);
+                    trace_flush();
                 } 
                 else if (valread == 0) {
                     // Handle client disconnection
+                    show_prompt = 1;
                     printf("\nClient socket %d disconnected\n", sock);
-                    close(sock);
-                    client_sockets[i].socket_fd = 0;
+                    lose_client(client_sockets, i, &map_job);
                 } 
                 else {
-                    perror("read error");
-                    close(sock);
-                    client_sockets[i].socket_fd = 0;
+                    show_prompt = 1;
+                    lose_client(client_sockets, i, &map_job);
                 }
             }
         }
     }
 
     // Close all client sockets before closing the server socket
-    for (int i = 0; i < MAX_CLIENTS; i++) {
+    for (int i = 0; i < CLIENT_SLOTS; i++) {
         if (client_sockets[i].socket_fd > 0) {
-            close(client_sockets[i].socket_fd);
+            client_detach(&client_sockets[i]);
         }
     }
+    arena_destroy(&arena);
     printf("Closing server socket...\n");
     close(fd_server);
 }
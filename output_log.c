@@ -0,0 +1,328 @@
+#include "output_log.h"
+#include "client_pool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_SEGMENTS (OUTPUT_RING_CHUNKS + 2)  // Spill log, then the ring split at each chunk and where it wraps
+
+static char log_directory[256];  // Private directory of the spill logs, made at the first client
+
+// A contiguous part of the output of a client
+typedef struct {
+    const char *data;
+    size_t length;
+} Segment;
+
+/**
+ * @brief Makes the directory of the spill logs, readable by the server only.
+ *
+ * A fresh directory from mkdtemp() cannot hold links planted by another user,
+ * unlike a predictable name in a shared directory such as /tmp.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int make_log_directory() {
+    if (log_directory[0] != '\0') return 0;
+
+    const char *parent = getenv("SERVER_LOG_DIR");
+    if (parent == NULL || parent[0] == '\0') {
+        parent = OUTPUT_LOG_DIR;
+    }
+    snprintf(log_directory, sizeof(log_directory), "%s/multi_server_XXXXXX", parent);
+    if (mkdtemp(log_directory) == NULL) {
+        perror("mkdtemp error");
+        log_directory[0] = '\0';
+        return -1;
+    }
+    printf("Client output logs are kept in %s\n", log_directory);
+    return 0;
+}
+
+/**
+ * @brief Prepares the ring of a newly connected client and creates its spill log.
+ *
+ * The log is named after the address of the client and starts empty. The ring
+ * takes its chunks from the arena as the output grows.
+ */
+void output_open(OutputLog *log, struct Arena *arena, struct sockaddr_in *address) {
+    log->arena = arena;
+    log->num_chunks = 0;
+    log->start = 0;
+    log->length = 0;
+    log->log_size = 0;
+    log->log_fd = -1;
+    log->log_path[0] = '\0';
+
+    if (make_log_directory() == 0) {
+        snprintf(log->log_path, sizeof(log->log_path), "%s/client_%s_%d.log",
+                 log_directory, inet_ntoa(address->sin_addr), ntohs(address->sin_port));
+
+        // A client that came back from the same address starts a new log
+        unlink(log->log_path);
+        log->log_fd = open(log->log_path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_APPEND | O_CLOEXEC, 0600);
+        if (log->log_fd == -1) {
+            perror("open error");
+        }
+    }
+    if (log->log_fd == -1) {
+        printf("Output older than %d KB will not be kept for this client\n", OUTPUT_RING_CHUNKS * CHUNK_SIZE / 1024);
+    }
+}
+
+/**
+ * @brief Gives the ring of a client back to the arena. The spill log stays on disk.
+ */
+void output_close(OutputLog *log) {
+    if (log->arena == NULL) return;
+    for (size_t i = 0; i < log->num_chunks; i++) {
+        arena_free(log->arena, log->ring[i]);
+    }
+    log->num_chunks = 0;
+    log->arena = NULL;
+    if (log->log_fd != -1) {
+        close(log->log_fd);
+        log->log_fd = -1;
+    }
+}
+
+/**
+ * @brief Appends bytes to the spill log (nothing if there is no log).
+ */
+static void log_write(OutputLog *log, const char *data, size_t length) {
+    while (log->log_fd != -1 && length > 0) {
+        ssize_t written = write(log->log_fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            perror("write error");
+            return;
+        }
+        log->log_size += written;
+        data += written;
+        length -= written;
+    }
+}
+
+/**
+ * @brief Gives the bytes of the ring from a position up to the end of its chunk or of the ring.
+ *
+ * @param log The output of the client.
+ * @param position Position in the ring, below its capacity.
+ * @param length Receives the number of contiguous bytes at that position.
+ */
+static char *ring_at(OutputLog *log, size_t position, size_t *length) {
+    *length = CHUNK_SIZE - position % CHUNK_SIZE;
+    return log->ring[position / CHUNK_SIZE] + position % CHUNK_SIZE;
+}
+
+/**
+ * @brief Moves the oldest bytes of the ring to the spill log.
+ */
+static void spill_oldest(OutputLog *log, size_t length) {
+    size_t capacity = log->num_chunks * CHUNK_SIZE;
+
+    log->length -= length;
+    while (length > 0) {
+        size_t size;
+        char *data = ring_at(log, log->start, &size);
+        if (size > length) size = length;
+        log_write(log, data, size);
+        log->start = (log->start + size) % capacity;
+        length -= size;
+    }
+}
+
+/**
+ * @brief Appends raw bytes to the output of a client.
+ */
+static void output_append(OutputLog *log, const char *data, size_t length) {
+    // The ring grows while its bytes do not wrap, then stays at the size it reached
+    while (log->start == 0 && log->length + length > log->num_chunks * CHUNK_SIZE &&
+           log->num_chunks < OUTPUT_RING_CHUNKS) {
+        char *chunk = arena_alloc(log->arena);
+        if (chunk == NULL) break;
+        log->ring[log->num_chunks++] = chunk;
+    }
+    size_t capacity = log->num_chunks * CHUNK_SIZE;
+
+    // More than the ring can hold: only the end of it stays in memory
+    if (length > capacity) {
+        spill_oldest(log, log->length);
+        log_write(log, data, length - capacity);
+        data += length - capacity;
+        length = capacity;
+    }
+    if (log->length + length > capacity) {
+        spill_oldest(log, log->length + length - capacity);
+    }
+
+    while (length > 0) {
+        size_t size;
+        char *end = ring_at(log, (log->start + log->length) % capacity, &size);
+        if (size > length) size = length;
+        memcpy(end, data, size);
+        log->length += size;
+        data += size;
+        length -= size;
+    }
+}
+
+/**
+ * @brief Records a message sent to a client or received from it, with the time.
+ *
+ * @param log The output of the client.
+ * @param prefix Written before the text (e.g. "$" for a command).
+ * @param text The message, possibly on several lines.
+ */
+void output_record(OutputLog *log, const char *prefix, const char *text) {
+    if (log->arena == NULL) return;
+
+    char stamp[64];
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    strftime(stamp, sizeof(stamp), "[%H:%M:%S] ", &local);
+
+    output_append(log, stamp, strlen(stamp));
+    if (prefix[0] != '\0') {
+        output_append(log, prefix, strlen(prefix));
+        output_append(log, " ", 1);
+    }
+    size_t length = strlen(text);
+    output_append(log, text, length);
+    if (length == 0 || text[length - 1] != '\n') {
+        output_append(log, "\n", 1);
+    }
+}
+
+/**
+ * @brief Gives the whole output of a client as segments, oldest first.
+ *
+ * @param map Receives the mapping of the spill log, to be released with munmap() (NULL if none).
+ * @return The number of segments.
+ */
+static int output_segments(OutputLog *log, Segment *segments, char **map) {
+    int count = 0;
+
+    *map = NULL;
+    if (log->log_fd != -1 && log->log_size > 0) {
+        *map = mmap(NULL, log->log_size, PROT_READ, MAP_SHARED, log->log_fd, 0);
+        if (*map == MAP_FAILED) {
+            perror("mmap error");
+            *map = NULL;
+        } else {
+            segments[count].data = *map;
+            segments[count++].length = log->log_size;
+        }
+    }
+
+    size_t position = log->start;
+    size_t remaining = log->length;
+    while (remaining > 0) {
+        size_t size;
+        segments[count].data = ring_at(log, position, &size);
+        if (size > remaining) size = remaining;
+        segments[count++].length = size;
+        position = (position + size) % (log->num_chunks * CHUNK_SIZE);
+        remaining -= size;
+    }
+    return count;
+}
+
+/**
+ * @brief Prints the last lines of the output of a client.
+ */
+void output_tail(OutputLog *log, int lines) {
+    Segment segments[MAX_SEGMENTS];
+    char *map;
+    int count = output_segments(log, segments, &map);
+    if (count == 0) return;
+
+    // Walk back from the end until enough newlines were seen
+    int segment = count - 1;
+    size_t offset = segments[segment].length;
+    int newlines = 0;
+    int skipped_last = 0;
+    while (1) {
+        if (offset == 0) {
+            if (segment == 0) break;
+            segment--;
+            offset = segments[segment].length;
+            continue;
+        }
+        if (segments[segment].data[offset - 1] == '\n') {
+            if (!skipped_last) {
+                skipped_last = 1;  // Ends the last line, not a line of its own
+            } else if (++newlines == lines) {
+                break;
+            }
+        }
+        skipped_last = 1;
+        offset--;
+    }
+
+    fwrite(segments[segment].data + offset, 1, segments[segment].length - offset, stdout);
+    for (int i = segment + 1; i < count; i++) {
+        fwrite(segments[i].data, 1, segments[i].length, stdout);
+    }
+
+    if (map != NULL) {
+        munmap(map, log->log_size);
+    }
+}
+
+/**
+ * @brief Prints the lines of the output of a client matching a regular expression.
+ *
+ * @return The number of matching lines, or -1 if the pattern is invalid.
+ */
+int output_grep(OutputLog *log, const char *pattern) {
+    regex_t regex;
+    int error = regcomp(&regex, pattern, REG_EXTENDED | REG_NOSUB);
+    if (error != 0) {
+        char message[256];
+        regerror(error, &regex, message, sizeof(message));
+        printf("Invalid pattern: %s\n", message);
+        return -1;
+    }
+
+    Segment segments[MAX_SEGMENTS];
+    char *map;
+    int count = output_segments(log, segments, &map);
+    char line[4 * 1024];
+    size_t length = 0;
+    int matches = 0;
+
+    // Lines may cross the border between the log and the ring, they are rebuilt in 'line'
+    for (int i = 0; i <= count; i++) {
+        const char *data = i < count ? segments[i].data : "\n";
+        size_t size = i < count ? segments[i].length : (length > 0);
+
+        while (size > 0) {
+            const char *newline = memchr(data, '\n', size);
+            size_t part = newline != NULL ? (size_t)(newline - data) : size;
+            size_t kept = part < sizeof(line) - 1 - length ? part : sizeof(line) - 1 - length;
+            memcpy(line + length, data, kept);
+            length += kept;
+            if (newline == NULL) break;
+
+            line[length] = '\0';
+            if (regexec(&regex, line, 0, NULL, 0) == 0) {
+                printf("%s\n", line);
+                matches++;
+            }
+            length = 0;
+            data = newline + 1;
+            size -= part + 1;
+        }
+    }
+
+    if (map != NULL) {
+        munmap(map, log->log_size);
+    }
+    regfree(&regex);
+    return matches;
+}
@@ -0,0 +1,35 @@
+#ifndef OUTPUT_LOG_H
+#define OUTPUT_LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#define OUTPUT_RING_CHUNKS 8          // Arena chunks of recent output kept in memory for each client (16 KB)
+#define OUTPUT_LOG_DIR "/tmp"         // Default parent of the private directory of the spill logs (SERVER_LOG_DIR overrides it)
+#define OUTPUT_TAIL_LINES 20          // Default number of lines shown by 'tail -id'
+
+struct Arena;
+
+// What was sent to a client and what it answered: the most recent bytes stay in
+// a ring of arena chunks, older ones are appended to a log file read back through mmap()
+typedef struct {
+    struct Arena *arena;       // Arena the ring comes from (NULL once closed)
+    char *ring[OUTPUT_RING_CHUNKS];
+    size_t num_chunks;         // Chunks taken so far, the ring grows with the output until the budget runs out
+    size_t start;              // Position of the oldest byte in the ring
+    size_t length;             // Bytes in the ring
+    int log_fd;                // Spill log (-1 if it could not be created: old output is dropped)
+    size_t log_size;
+    char log_path[512];
+} OutputLog;
+
+void output_open(OutputLog *log, struct Arena *arena, struct sockaddr_in *address);
+void output_close(OutputLog *log);
+void output_record(OutputLog *log, const char *prefix, const char *text);
+void output_tail(OutputLog *log, int lines);
+int output_grep(OutputLog *log, const char *pattern);
+
+#endif
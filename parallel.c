@@ -0,0 +1,363 @@
+#include "parallel.h"
+#include "timeout.h"
+#include "variables.h"
+#include <sys/select.h>
+
+/**
+ * @brief Finds a 'parallel' stage in a command line.
+ *
+ * Everything after 'parallel' (pipes included) is the template of the items,
+ * everything before it is a pipeline producing the items. The '|' separating
+ * both parts is replaced by '\0'.
+ *
+ * @param command The command line.
+ * @param producer Set to the producer pipeline, or NULL if 'parallel' is the first stage.
+ * @return A pointer to the 'parallel' stage, or NULL if there is none.
+ */
+char *find_parallel_stage(char *command, char **producer) {
+    char *stage = command;
+
+    while (stage != NULL) {
+        char *start = stage;
+        while (*start == ' ' || *start == '\t') start++;
+
+        if (strncmp(start, "parallel", 8) == 0 &&
+            (start[8] == ' ' || start[8] == '\t' || start[8] == '\n' || start[8] == '\0')) {
+            *producer = NULL;
+            if (stage != command) {
+                *(stage - 1) = '\0';  // Cut the producer pipeline before the '|'
+                *producer = command;
+            }
+            return start;
+        }
+
+        stage = find_unquoted(stage, "|");
+        if (stage != NULL) stage++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Extracts the next complete line from the input buffer.
+ *
+ * @return 1 if a line was copied into 'item', 0 otherwise.
+ */
+static int next_item(char *buffer, size_t *length, int eof, char *item) {
+    while (*length > 0) {
+        char *newline = memchr(buffer, '\n', *length);
+        size_t line_length;
+        size_t consumed;
+
+        if (newline != NULL) {
+            line_length = newline - buffer;
+            consumed = line_length + 1;
+        } else if (eof || *length >= MAX_LINE - 1) {
+            line_length = *length;  // Last line without newline, or line too long
+            consumed = *length;
+        } else {
+            return 0;
+        }
+
+        if (line_length > MAX_LINE - 1) line_length = MAX_LINE - 1;
+        memcpy(item, buffer, line_length);
+        item[line_length] = '\0';
+        memmove(buffer, buffer + consumed, *length - consumed);
+        *length -= consumed;
+
+        if (item[0] != '\0') return 1;  // Skip empty lines
+    }
+    return 0;
+}
+
+/**
+ * @brief Starts an item in a child process whose output goes to a pipe.
+ *
+ * The child runs the item through execute_command(), so an item can use
+ * redirections and pipes like any other command line.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int start_job(ParallelSlot *slot, const char *template, const char *input, int item) {
+    char command[MAX_LINE];
+    int pipefd[2];
+
+    if (substitute_item(template, input, command, sizeof(command)) < 0) {
+        printf("parallel: command too long for item %d, skipped.\n", item);
+        return -1;
+    }
+    if (pipe(pipefd) < 0) {
+        perror("pipe error");
+        return -1;
+    }
+
+    fflush(stdout);  // Do not duplicate pending output in the child
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Items are read by the parent, the job must not consume them
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd != -1) {
+            dup2(null_fd, STDIN_FILENO);
+            close(null_fd);
+        }
+        dup2(pipefd[1], STDOUT_FILENO);
+        dup2(pipefd[1], STDERR_FILENO);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        int status = execute_command(command);
+        fflush(stdout);
+        _exit(status < 0 ? 255 : status);
+    }
+    else if (pid < 0) {
+        perror("fork error");
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    }
+
+    close(pipefd[1]);
+    slot->pid = pid;
+    slot->fd = pipefd[0];
+    slot->item = item;
+    snprintf(slot->input, sizeof(slot->input), "%s", input);
+    slot->length = 0;
+    return 0;
+}
+
+/**
+ * @brief Waits for a job whose output is complete and prints it in one block.
+ *
+ * @return The exit status of the job.
+ */
+static int finish_job(ParallelSlot *slot) {
+    int wstatus;
+    int status = 255;
+
+    close(slot->fd);
+    if (waitpid(slot->pid, &wstatus, 0) == slot->pid) {
+        status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+    }
+
+    printf("--- [%d] %s: exit status %d\n", slot->item, slot->input, status);
+    fwrite(slot->output, 1, slot->length, stdout);
+    if (slot->length > 0 && slot->output[slot->length - 1] != '\n') {
+        printf("\n");
+    }
+    fflush(stdout);
+
+    slot->pid = 0;
+    slot->fd = -1;
+    return status;
+}
+
+/**
+ * @brief Runs the items of the 'parallel' builtin: "parallel [-j N] <command with {}>".
+ *
+ * Items are read line by line from stdin, or from the output of the producer
+ * pipeline if one precedes the builtin, and run on a pool of at most N
+ * children (the number of cores by default). The output of each job is kept
+ * together and followed by its exit status.
+ *
+ * @param producer The pipeline producing the items (NULL to read stdin).
+ * @param stage The 'parallel' stage returned by find_parallel_stage().
+ * @return 0 if every item succeeded, 1 otherwise.
+ */
+static int run_items(char *producer, char *stage) {
+    ParallelSlot slots[MAX_PARALLEL_JOBS];
+    char buffer[MAX_LINE * 4];
+    char item[MAX_LINE];
+    size_t buffered = 0;
+    int eof = 0;
+    int num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int running = 0;
+    int started = 0;
+    int failed = 0;
+    pid_t producer_pid = -1;
+    int input_fd = STDIN_FILENO;
+
+    // Parse the options
+    char *template = stage + strlen("parallel");
+    while (*template == ' ' || *template == '\t') template++;
+    if (strncmp(template, "-j", 2) == 0) {
+        template += 2;
+        while (*template == ' ' || *template == '\t') template++;
+        num_jobs = atoi(template);
+        while (*template != '\0' && *template != ' ' && *template != '\t') template++;
+        while (*template == ' ' || *template == '\t') template++;
+    }
+    template[strcspn(template, "\n")] = '\0';
+
+    if (*template == '\0' || num_jobs <= 0) {
+        printf("Usage: parallel [-j N] <command with {}>\n");
+        return -1;
+    }
+    if (num_jobs > MAX_PARALLEL_JOBS) num_jobs = MAX_PARALLEL_JOBS;
+
+    // Run the producer pipeline, if any, with its output going to our input
+    if (producer != NULL) {
+        int pipefd[2];
+        if (pipe(pipefd) < 0) {
+            perror("pipe error");
+            return -1;
+        }
+        fflush(stdout);
+        producer_pid = fork();
+        if (producer_pid == 0) {
+            dup2(pipefd[1], STDOUT_FILENO);
+            close(pipefd[0]);
+            close(pipefd[1]);
+            int status = execute_command(producer);
+            fflush(stdout);
+            _exit(status < 0 ? 255 : status);
+        }
+        else if (producer_pid < 0) {
+            perror("fork error");
+            close(pipefd[0]);
+            close(pipefd[1]);
+            return -1;
+        }
+        close(pipefd[1]);
+        input_fd = pipefd[0];
+    }
+
+    for (int i = 0; i < num_jobs; i++) {
+        slots[i].pid = 0;
+        slots[i].fd = -1;
+        slots[i].output = NULL;
+        slots[i].capacity = 0;
+    }
+
+    while (!eof || buffered > 0 || running > 0) {
+        // Fill the free slots with the items already read
+        for (int i = 0; i < num_jobs; i++) {
+            if (slots[i].pid != 0) continue;
+            if (!next_item(buffer, &buffered, eof, item)) break;
+            started++;
+            if (start_job(&slots[i], template, item, started) == 0) {
+                running++;
+            } else {
+                failed++;
+            }
+        }
+        if (eof && running == 0) break;  // Every item has been run
+
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        int max_fd = -1;
+        for (int i = 0; i < num_jobs; i++) {
+            if (slots[i].pid != 0) {
+                FD_SET(slots[i].fd, &readfds);
+                if (slots[i].fd > max_fd) max_fd = slots[i].fd;
+            }
+        }
+        // Only read more items when one can be started
+        if (!eof && running < num_jobs) {
+            FD_SET(input_fd, &readfds);
+            if (input_fd > max_fd) max_fd = input_fd;
+        }
+        if (max_fd < 0) break;
+
+        if (select(max_fd + 1, &readfds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR) continue;
+            perror("select error");
+            break;
+        }
+
+        if (!eof && running < num_jobs && FD_ISSET(input_fd, &readfds)) {
+            ssize_t n = read(input_fd, buffer + buffered, sizeof(buffer) - buffered);
+            if (n <= 0) {
+                eof = 1;
+            } else {
+                buffered += n;
+            }
+        }
+
+        // Collect the output of the running jobs
+        for (int i = 0; i < num_jobs; i++) {
+            ParallelSlot *slot = &slots[i];
+            if (slot->pid == 0 || !FD_ISSET(slot->fd, &readfds)) continue;
+
+            if (slot->capacity - slot->length < MAX_LINE) {
+                slot->capacity = slot->capacity == 0 ? MAX_LINE * 4 : slot->capacity * 2;
+                slot->output = realloc(slot->output, slot->capacity);
+            }
+            ssize_t n = read(slot->fd, slot->output + slot->length, slot->capacity - slot->length);
+            if (n > 0) {
+                slot->length += n;
+            } else {
+                if (finish_job(slot) != 0) failed++;
+                running--;
+            }
+        }
+    }
+
+    for (int i = 0; i < num_jobs; i++) {
+        free(slots[i].output);
+    }
+
+    if (producer_pid > 0) {
+        close(input_fd);
+        waitpid(producer_pid, NULL, 0);
+    } else {
+        clearerr(stdin);  // The terminal may have sent EOF to end the items
+    }
+
+    printf("parallel: %d item(s), %d failed\n", started, failed);
+    return failed > 0 ? 1 : 0;
+}
+
+/**
+ * @brief Runs the 'parallel' builtin, under the timeout and the limits of its command line.
+ *
+ * With a timeout or limits, the builtin runs in a child (in its own process
+ * group when there is a timeout), inside the leaf cgroup (or under the rlimits) of the line: the
+ * producer and every job are its descendants, so the deadline and the limits
+ * cover all of them.
+ *
+ * @param producer The pipeline producing the items (NULL to read stdin).
+ * @param stage The 'parallel' stage returned by find_parallel_stage().
+ * @param timeout_ms The deadline of the whole run (0 for none).
+ * @param limits The limits of the line (with the client's ones for server commands).
+ * @return 0 if every item succeeded, 1 otherwise, TIMEOUT_STATUS if the deadline expired.
+ */
+int run_parallel(char *producer, char *stage, long timeout_ms, ResourceLimits *limits) {
+    if (timeout_ms == 0 && !limits_enabled(limits)) {
+        return run_items(producer, stage);
+    }
+
+    limits_prepare(limits);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (timeout_ms > 0) {
+            setpgid(0, 0);
+        }
+        signal(SIGINT, SIG_DFL);   // Stopped like the processes of a pipeline, not like the shell
+        signal(SIGTERM, SIG_DFL);
+        limits_apply_child(limits);
+        use_default_limits = 0;  // Already applied here, the jobs must not leave the leaf for their own
+        int status = run_items(producer, stage);
+        fflush(stdout);
+        _exit(status < 0 ? 255 : status);
+    }
+    else if (pid < 0) {
+        perror("fork error");
+        limits_finish(limits);
+        return -1;
+    }
+    int status;
+    if (timeout_ms > 0) {
+        JobTimeout job;
+        setpgid(pid, pid);
+        timeout_start(&job, pid, timeout_ms, 0);
+        status = wait_pipeline(&pid, 1, pid);
+        timer_cancel(&job.timer);
+        if (job.signal_sent != 0) {
+            command_timed_out = 1;
+            status = TIMEOUT_STATUS;
+        }
+    } else {
+        status = wait_pipeline(&pid, 1, pid);
+    }
+    limits_finish(limits);
+    return status;
+}
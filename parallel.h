@@ -0,0 +1,23 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "shell.h"
+#include "limits.h"
+
+#define MAX_PARALLEL_JOBS 64  // Upper bound for 'parallel -j N'
+
+// A job of the 'parallel' builtin and the output it produced so far
+typedef struct {
+    pid_t pid;          // Process running the item (0 if the slot is free)
+    int fd;             // Read end of the pipe collecting stdout and stderr
+    int item;           // Number of the item in the input
+    char input[MAX_LINE];
+    char *output;       // Output kept until the job ends so it is printed in one block
+    size_t length;
+    size_t capacity;
+} ParallelSlot;
+
+char *find_parallel_stage(char *command, char **producer);
+int run_parallel(char *producer, char *stage, long timeout_ms, ResourceLimits *limits);
+
+#endif
@@ -0,0 +1,221 @@
+#include "path_index.h"
+#include "variables.h"
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define INOTIFY_BUFFER_SIZE 16384
+#define WATCHED_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+                        IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// Executables of $PATH sorted by name, so a prefix is found by binary search
+static Executable *entries = NULL;
+static size_t num_entries = 0;
+static size_t capacity = 0;
+
+static char *indexed_path = NULL;              // Value of $PATH the index was built from
+static char *dirs[PATH_INDEX_MAX_DIRS];
+static int watches[PATH_INDEX_MAX_DIRS];       // inotify watch of each directory (-1 if not watched)
+static int num_dirs = 0;
+static int inotify_fd = -1;
+
+/**
+ * @brief Finds the position of a name in the index, or where it would be inserted.
+ */
+static size_t index_position(const char *name) {
+    size_t low = 0;
+    size_t high = num_entries;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (strcmp(entries[middle].name, name) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief Records that a directory of $PATH holds an executable.
+ */
+static void index_add(const char *name, int dir) {
+    size_t position = index_position(name);
+    if (position < num_entries && strcmp(entries[position].name, name) == 0) {
+        entries[position].dirs |= 1ULL << dir;
+        return;
+    }
+
+    if (num_entries == capacity) {
+        capacity = capacity == 0 ? 1024 : capacity * 2;
+        entries = realloc(entries, capacity * sizeof(Executable));
+    }
+    memmove(entries + position + 1, entries + position, (num_entries - position) * sizeof(Executable));
+    entries[position].name = strdup(name);
+    entries[position].dirs = 1ULL << dir;
+    num_entries++;
+}
+
+/**
+ * @brief Records that a directory of $PATH no longer holds an executable.
+ */
+static void index_remove(const char *name, int dir) {
+    size_t position = index_position(name);
+    if (position == num_entries || strcmp(entries[position].name, name) != 0) {
+        return;
+    }
+
+    entries[position].dirs &= ~(1ULL << dir);
+    if (entries[position].dirs == 0) {
+        free(entries[position].name);
+        num_entries--;
+        memmove(entries + position, entries + position + 1, (num_entries - position) * sizeof(Executable));
+    }
+}
+
+/**
+ * @brief Tells if an entry of a directory is an executable file.
+ */
+static int is_executable(int dir_fd, const char *name) {
+    struct stat info;
+    return fstatat(dir_fd, name, &info, 0) == 0 && S_ISREG(info.st_mode) && (info.st_mode & 0111) != 0;
+}
+
+/**
+ * @brief Adds the executables of a directory of $PATH to the index.
+ */
+static void scan_directory(int dir) {
+    DIR *stream = opendir(dirs[dir]);
+    if (stream == NULL) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(stream)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_type == DT_DIR) continue;
+        if (is_executable(dirfd(stream), entry->d_name)) {
+            index_add(entry->d_name, dir);
+        }
+    }
+    closedir(stream);
+}
+
+/**
+ * @brief Builds the index again from the current $PATH, and watches its directories.
+ *
+ * The watches are set before the directories are read, so a file created while
+ * reading is not missed.
+ */
+static void path_index_rebuild(const char *path) {
+    for (size_t i = 0; i < num_entries; i++) {
+        free(entries[i].name);
+    }
+    num_entries = 0;
+    for (int i = 0; i < num_dirs; i++) {
+        free(dirs[i]);
+    }
+    num_dirs = 0;
+    if (inotify_fd != -1) {
+        close(inotify_fd);
+    }
+    free(indexed_path);
+    indexed_path = strdup(path);
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        perror("inotify_init1 error");
+    }
+
+    char *copy = strdup(path);
+    char *saveptr;
+    char *dir = strtok_r(copy, ":", &saveptr);
+    while (dir != NULL && num_dirs < PATH_INDEX_MAX_DIRS) {
+        int duplicate = 0;
+        for (int i = 0; i < num_dirs; i++) {
+            if (strcmp(dirs[i], dir) == 0) duplicate = 1;
+        }
+        if (!duplicate) {
+            dirs[num_dirs] = strdup(dir);
+            watches[num_dirs] = inotify_fd != -1 ? inotify_add_watch(inotify_fd, dir, WATCHED_EVENTS) : -1;
+            scan_directory(num_dirs);
+            num_dirs++;
+        }
+        dir = strtok_r(NULL, ":", &saveptr);
+    }
+    free(copy);
+}
+
+/**
+ * @brief Applies a change of a directory of $PATH to the index.
+ */
+static void apply_event(struct inotify_event *event) {
+    int dir = 0;
+    while (dir < num_dirs && watches[dir] != event->wd) dir++;
+    if (dir == num_dirs) return;
+
+    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        // The directory itself is gone: forget everything it held
+        for (size_t i = num_entries; i > 0; i--) {
+            index_remove(entries[i - 1].name, dir);
+        }
+        watches[dir] = -1;
+        return;
+    }
+    if (event->len == 0 || event->name[0] == '.') return;
+
+    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        index_remove(event->name, dir);
+        return;
+    }
+
+    // Created, moved in, written or made (not) executable
+    int dir_fd = open(dirs[dir], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) return;
+    if (is_executable(dir_fd, event->name)) {
+        index_add(event->name, dir);
+    } else {
+        index_remove(event->name, dir);
+    }
+    close(dir_fd);
+}
+
+/**
+ * @brief Brings the index up to date before it is used.
+ *
+ * The directories are only read again when $PATH itself changes; otherwise only
+ * the changes reported by inotify since the last call are applied.
+ */
+void path_index_refresh() {
+    const char *path = variable_get("PATH");
+    if (path == NULL) path = "";
+    if (indexed_path == NULL || strcmp(path, indexed_path) != 0) {
+        path_index_rebuild(path);
+        return;
+    }
+
+    char buffer[INOTIFY_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while (inotify_fd != -1 && (length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *cursor = buffer; cursor < buffer + length; ) {
+            struct inotify_event *event = (struct inotify_event *)cursor;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Too many changes were missed, read everything again
+                path_index_rebuild(path);
+                return;
+            }
+            apply_event(event);
+            cursor += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+/**
+ * @brief Gives the n-th executable whose name starts with a prefix.
+ *
+ * @return The name, or NULL if there are fewer matches.
+ */
+const char *path_index_match(const char *prefix, size_t n) {
+    size_t position = index_position(prefix) + n;
+    if (position < num_entries && strncmp(entries[position].name, prefix, strlen(prefix)) == 0) {
+        return entries[position].name;
+    }
+    return NULL;
+}
@@ -0,0 +1,17 @@
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+#include "shell.h"
+
+#define PATH_INDEX_MAX_DIRS 64  // Directories of $PATH indexed (one bit each)
+
+// An executable found in $PATH
+typedef struct {
+    char *name;
+    unsigned long long dirs;   // Directories of $PATH holding it (bit i for the i-th one)
+} Executable;
+
+void path_index_refresh();
+const char *path_index_match(const char *prefix, size_t n);
+
+#endif
@@ -0,0 +1,187 @@
+#include "protocol.h"
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+
+#define READ_SIZE 4096  // Minimum free space given to each read()
+
+/**
+ * @brief Writes the header of a frame.
+ *
+ * @param header Buffer of FRAME_HEADER_SIZE bytes.
+ * @param type The type of the frame.
+ * @param length The length of the payload.
+ */
+void frame_header(char *header, char type, size_t length) {
+    uint32_t network_length = htonl((uint32_t)length);
+    memcpy(header, &network_length, sizeof(network_length));
+    header[4] = type;
+}
+
+/**
+ * @brief Decodes the frame at the beginning of a buffer.
+ *
+ * @param buffer The bytes received.
+ * @param available The number of bytes received.
+ * @param frame Receives the frame.
+ * @return The size of the frame (header included) if it is complete, 0 if more
+ *         bytes are needed, -1 if the frame is invalid.
+ */
+int frame_parse(char *buffer, size_t available, Frame *frame) {
+    uint32_t network_length;
+
+    if (available < FRAME_HEADER_SIZE) {
+        return 0;
+    }
+    memcpy(&network_length, buffer, sizeof(network_length));
+    frame->length = ntohl(network_length);
+    frame->type = buffer[4];
+    frame->payload = buffer + FRAME_HEADER_SIZE;
+
+    if (frame->length > MAX_FRAME_SIZE) {
+        printf("Frame too large (%u bytes)\n", frame->length);
+        return -1;
+    }
+    if (available < FRAME_HEADER_SIZE + frame->length) {
+        return 0;
+    }
+
+    // Text frames must be null-terminated
+    if (frame->type != FRAME_DATA && (frame->length == 0 || frame->payload[frame->length - 1] != '\0')) {
+        printf("Invalid frame of type '%c'\n", frame->type);
+        return -1;
+    }
+    return FRAME_HEADER_SIZE + frame->length;
+}
+
+/**
+ * @brief Sends a whole frame on a blocking socket.
+ *
+ * The header and the payload leave in a single system call, so a small frame
+ * is a single TCP segment.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int send_frame(int fd, char type, const char *payload, size_t length) {
+    char header[FRAME_HEADER_SIZE];
+    struct iovec parts[2];
+
+    frame_header(header, type, length);
+    parts[0].iov_base = header;
+    parts[0].iov_len = FRAME_HEADER_SIZE;
+    parts[1].iov_base = (char *)payload;
+    parts[1].iov_len = length;
+
+    struct msghdr message = {0};
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+
+    size_t remaining = FRAME_HEADER_SIZE + length;
+    while (remaining > 0) {
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            perror("send error");
+            return -1;
+        }
+        remaining -= sent;
+
+        // Skip what was sent for the next try
+        while (message.msg_iovlen > 0 && (size_t)sent >= message.msg_iov->iov_len) {
+            sent -= message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0) {
+            message.msg_iov->iov_base = (char *)message.msg_iov->iov_base + sent;
+            message.msg_iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the bytes available on a socket into a frame reader (a single read()).
+ *
+ * @return The number of bytes read, 0 if the peer closed the connection, -1 on error.
+ */
+int frame_read(int fd, FrameReader *reader) {
+    // Make room for the frame being received, or at least for a good read
+    size_t needed = reader->length + READ_SIZE;
+    if (reader->length >= FRAME_HEADER_SIZE) {
+        uint32_t network_length;
+        memcpy(&network_length, reader->data, sizeof(network_length));
+        size_t frame_size = FRAME_HEADER_SIZE + (size_t)ntohl(network_length);
+        if (frame_size <= FRAME_HEADER_SIZE + MAX_FRAME_SIZE && frame_size > needed) {
+            needed = frame_size;
+        }
+    }
+    if (needed > reader->capacity) {
+        reader->data = realloc(reader->data, needed);
+        reader->capacity = needed;
+    }
+
+    ssize_t received;
+    do {
+        received = read(fd, reader->data + reader->length, reader->capacity - reader->length);
+    } while (received < 0 && errno == EINTR);
+    if (received < 0) {
+        perror("read error");
+        return -1;
+    }
+    reader->length += received;
+    return received;
+}
+
+/**
+ * @brief Drops the frame returned last by frame_next() from a reader.
+ */
+void frame_reader_compact(FrameReader *reader) {
+    if (reader->consumed > 0) {
+        memmove(reader->data, reader->data + reader->consumed, reader->length - reader->consumed);
+        reader->length -= reader->consumed;
+        reader->consumed = 0;
+    }
+}
+
+/**
+ * @brief Gives the next complete frame of a reader.
+ *
+ * The frame stays valid until the next call.
+ *
+ * @return 1 if a frame is available, 0 if more bytes are needed, -1 if the stream is invalid.
+ */
+int frame_next(FrameReader *reader, Frame *frame) {
+    frame_reader_compact(reader);
+
+    int size = frame_parse(reader->data, reader->length, frame);
+    if (size <= 0) {
+        return size;
+    }
+    reader->consumed = size;
+    return 1;
+}
+
+/**
+ * @brief Waits for the next frame on a blocking socket.
+ *
+ * @return 1 if a frame was received, 0 if the peer closed the connection, -1 on error.
+ */
+int receive_frame(int fd, FrameReader *reader, Frame *frame) {
+    int result;
+    while ((result = frame_next(reader, frame)) == 0) {
+        int received = frame_read(fd, reader);
+        if (received <= 0) {
+            return received;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Releases the buffer of a frame reader.
+ */
+void frame_reader_free(FrameReader *reader) {
+    free(reader->data);
+    memset(reader, 0, sizeof(*reader));
+}
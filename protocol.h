@@ -0,0 +1,58 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Every message between the server and a client is a frame:
+// 4 bytes of payload length (network order), 1 byte of type, then the payload.
+// Text payloads include their terminating null byte, FRAME_DATA payloads are raw bytes.
+#define FRAME_HEADER_SIZE 5
+#define MAX_FRAME_SIZE (1024 * 1024)  // Largest payload accepted
+
+// Types of frames
+#define FRAME_COMMAND 'C'   // Server -> client: a command line (may span several lines)
+#define FRAME_SCRIPT 'S'    // Server -> client: a script run step by step, stopping at the first failure
+#define FRAME_RESPONSE 'R'  // Client -> server: the result of a command or a script
+#define FRAME_TRACE 'T'     // Server -> client: trace ID of the next command or script (only when tracing)
+#define FRAME_PUSH 'P'      // Server -> client: "<size> <checksum> <path>", a file the server is about to send
+#define FRAME_PULL 'G'      // Server -> client: "<path>", a file the client should send
+#define FRAME_FILE 'F'      // Client -> server: "<size> <checksum>", the file it is about to send
+#define FRAME_OFFSET 'O'    // Receiver -> sender: "<offset> [<chunk>]", bytes of the file already received (-1 to cancel) and largest data frame for a pull
+#define FRAME_DATA 'D'      // Both ways: the next bytes of a file (binary payload)
+#define FRAME_PING 'H'      // Server -> client: "<sequence>", a heartbeat the client answers at once
+#define FRAME_PONG 'E'      // Client -> server: the payload of the ping it answers
+#define FRAME_SESSION 'N'   // Server -> client: "<token>", the session of a new connection
+#define FRAME_RESUME 'A'    // Client -> server: "<token> <commands received>", reattach to a lost session
+#define FRAME_RESUMED 'Y'   // Server -> client: "<responses received>" in the session, or "-1" if it is gone
+#define FRAME_CLOSE 'X'     // Client -> server: the client leaves for good, its session ends
+
+// A frame received, pointing into the buffer it was read into
+typedef struct {
+    char type;
+    uint32_t length;
+    char *payload;
+} Frame;
+
+// Reassembles the frames read from a blocking socket
+typedef struct {
+    char *data;
+    size_t length;      // Bytes read
+    size_t capacity;
+    size_t consumed;    // Size of the frame returned last, dropped on the next call
+} FrameReader;
+
+void frame_header(char *header, char type, size_t length);
+int frame_parse(char *buffer, size_t available, Frame *frame);
+int send_frame(int fd, char type, const char *payload, size_t length);
+int frame_read(int fd, FrameReader *reader);
+int frame_next(FrameReader *reader, Frame *frame);
+void frame_reader_compact(FrameReader *reader);
+int receive_frame(int fd, FrameReader *reader, Frame *frame);
+void frame_reader_free(FrameReader *reader);
+
+#endif
@@ -0,0 +1,144 @@
+#include "script.h"
+#include "heredoc.h"
+#include "timeout.h"
+#include <stdarg.h>
+#include <time.h>
+
+// Text of the report, grown as the steps run
+typedef struct {
+    char *text;
+    size_t length;
+    size_t capacity;
+} Report;
+
+/**
+ * @brief Appends formatted text to a report.
+ */
+static void report_append(Report *report, const char *format, ...) {
+    va_list args;
+
+    while (1) {
+        size_t available = report->capacity - report->length;
+        va_start(args, format);
+        int written = vsnprintf(report->text + report->length, available, format, args);
+        va_end(args);
+        if (written < 0) return;
+        if ((size_t)written < available) {
+            report->length += written;
+            return;
+        }
+        report->capacity = report->capacity * 2 + written;
+        report->text = realloc(report->text, report->capacity);
+    }
+}
+
+/**
+ * @brief Returns the current time in milliseconds (monotonic clock).
+ */
+static double now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+/**
+ * @brief Tells if a line of a script is empty or a comment.
+ */
+static int is_blank_step(const char *line) {
+    line += strspn(line, " \t\r\n");
+    return *line == '\0' || *line == '#';
+}
+
+/**
+ * @brief Reads a whole script file.
+ *
+ * @param path The path of the file.
+ * @param length Receives the length of the script.
+ * @return The script, to be freed by the caller, or NULL on error.
+ */
+char *read_script(const char *path, size_t *length) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("fopen error");
+        return NULL;
+    }
+
+    size_t capacity = MAX_LINE;
+    char *script = malloc(capacity);
+    *length = 0;
+    size_t got;
+    while ((got = fread(script + *length, 1, capacity - *length - 1, file)) > 0) {
+        *length += got;
+        if (capacity - *length - 1 == 0) {
+            capacity *= 2;
+            script = realloc(script, capacity);
+        }
+    }
+    script[*length] = '\0';
+    fclose(file);
+    return script;
+}
+
+/**
+ * @brief Runs a script step by step, stopping at the first step that fails (like 'set -e').
+ *
+ * Each step is a line of the script, with the bodies of its here-documents.
+ * Empty lines and comments are ignored.
+ *
+ * @param script The script, modified while it runs.
+ * @param status Receives the status of the step that failed, 0 if every step succeeded.
+ * @return The report (status and duration of each step), to be freed by the caller.
+ */
+char *run_script(char *script, int *status) {
+    Report report = {malloc(MAX_LINE), 0, MAX_LINE};
+    report.text[0] = '\0';
+    Report steps = {malloc(MAX_LINE), 0, MAX_LINE};
+    steps.text[0] = '\0';
+
+    char *cursor = script;
+    char *step;
+    int num_steps = 0;
+    int num_run = 0;
+    int failed_step = 0;
+    double start = now_ms();
+
+    *status = 0;
+    while ((step = heredoc_next_line(&cursor)) != NULL) {
+        if (is_blank_step(step)) continue;
+        num_steps++;
+
+        // Keep the first line of the step for the report, execute_command() modifies it
+        char display[SCRIPT_STEP_DISPLAY + 4];
+        size_t length = strcspn(step, "\n");
+        snprintf(display, sizeof(display), "%.*s%s", (int)(length < SCRIPT_STEP_DISPLAY ? length : SCRIPT_STEP_DISPLAY),
+                 step, length > SCRIPT_STEP_DISPLAY ? "..." : "");
+
+        if (failed_step != 0) {
+            report_append(&steps, "  [%d] skipped                   %s\n", num_steps, display);
+            continue;
+        }
+
+        double step_start = now_ms();
+        int step_status = execute_command(step);
+        double duration = now_ms() - step_start;
+        num_run++;
+
+        if (command_timed_out) {
+            report_append(&steps, "  [%d] timed out  %10.1f ms  %s\n", num_steps, duration, display);
+        } else {
+            report_append(&steps, "  [%d] status %-3d %10.1f ms  %s\n", num_steps, step_status, duration, display);
+        }
+        if (step_status != 0) {
+            failed_step = num_steps;
+            *status = step_status;
+        }
+    }
+
+    report_append(&report, "Script: %d/%d step(s) run in %.1f ms", num_run, num_steps, now_ms() - start);
+    if (failed_step != 0) {
+        report_append(&report, ", stopped at step %d", failed_step);
+    }
+    report_append(&report, "\n%s", steps.text);
+    free(steps.text);
+    return report.text;
+}
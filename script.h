@@ -0,0 +1,11 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "shell.h"
+
+#define SCRIPT_STEP_DISPLAY 60  // Characters of each step shown in the report
+
+char *read_script(const char *path, size_t *length);
+char *run_script(char *script, int *status);
+
+#endif
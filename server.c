@@ -1,5 +1,14 @@
 #include "shell.h"
 #include "server.h"
+#include "protocol.h"
+#include "script.h"
+#include "console.h"
+
+// Commands of the server console, completed with the Tab key
+const char *server_commands[] = {
+    "help_server", "exit_server", "exit_client", "list_clients", "memory_stats",
+    "tail", "grep", "push", "pull", "-script", "-map", "-local", NULL
+};
 
 /**
  * @brief Prints the available server commands and their usage.
@@ -9,11 +18,21 @@ void print_server_help() {
     printf("  exit : Close the server (local mode) or disconnect a client (connected mode)\n");
     printf("  exit_server: Shut down the server (connected mode)\n");
     printf("  exit_client: Disconnect a client from the server (connected mode)\n");
-    printf("  list_clients: List all currently connected clients (multi_server mode only)\n");
+    printf("  list_clients: List all currently connected clients and their heartbeat round trips\n");
+    printf("      (last, average, 99th percentile); silent clients are evicted (multi_server mode only)\n");
+    printf("  memory_stats: Show the memory budget used by the clients (multi_server mode only)\n");
     printf("  help_server: Display this help message\n");
+    printf("  tail -id <x> [n] / grep -id <x> <pattern>: Show the last lines of what was sent to a client\n");
+    printf("      and what it answered, or the lines matching a regular expression (multi_server mode only)\n");
+    printf("  -script <file> : Send a whole script in one message, the client runs it step by step\n");
+    printf("      and stops at the first failure (multi_server: add -all or -id <x>)\n");
+    printf("  push <local> <remote> -all|-id <x> / pull <remote> <local> -all|-id <x>: Copy a file to\n");
+    printf("      clients or from them, resuming an interrupted copy (multi_server mode only)\n");
     printf("\nFor multi_server mode:\n");
     printf("  Commands execute locally by default.\n");
     printf("  Use '-all' to send a command to all clients, or '-id <x>' to target specific client(s).\n");
+    printf("  -map <file> <cmd with {}> [-ordered]: Run the command once per line of the file,\n");
+    printf("      spreading the lines over the connected clients (failed lines are retried elsewhere).\n");
 }
 
 /**
@@ -40,6 +59,7 @@ void server(int port) {
     signal(SIGINT, handle_sigint);
     signal(SIGTSTP, handle_sigtstp);
     signal(SIGTERM, handle_sigterm);
+    console_init(server_commands, NULL, 0);
 
     // Create server socket
     if ((fd_server = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
@@ -73,10 +93,15 @@ void server(int port) {
     fd_set readfds;
     int max_fd = fd_server;
 
+    int show_prompt = 1;
     while (1) {
-        printf("\nServer waiting for connection (PORT: %d)...\n", port);
-        printf("\n%s> ", get_path());
-        fflush(stdout);
+        if (show_prompt) {
+            char prompt[MAX_LINE + 3];
+            snprintf(prompt, sizeof(prompt), "%s> ", get_path());
+            printf("\nServer waiting for connection (PORT: %d)...\n\n", port);
+            console_prompt(prompt);
+        }
+        show_prompt = 1;
 
         // Reset the file descriptor set
         FD_ZERO(&readfds);
@@ -92,8 +117,12 @@ void server(int port) {
         
         // Check if a local command was entered
         if (FD_ISSET(STDIN_FILENO, &readfds)) {
-            memset(buffer, 0, MAX_LINE + 1);
-            if (fgets(buffer, MAX_LINE, stdin) != NULL) {
+            memset(buffer, 0, sizeof(buffer));
+            int ready = console_line_ready(buffer, MAX_LINE);
+            if (ready == 0) {
+                show_prompt = 0;  // Only part of a line was typed
+            }
+            if (ready == 1) {
                 buffer[strcspn(buffer, "\n")] = 0; // Remove newline character
                 if (strcmp(buffer, "help_server") == 0) {
                     printf("\n");
@@ -114,13 +143,13 @@ void server(int port) {
             }
 
             printf("\nConnection established with client\n");
+            FrameReader reader = {0};  // Responses of the client
 
             // Communication loop with the client
             while (1) {
                 printf("\nEnter command to send to the client (type 'exit_client' to disconnect):\n");
-                printf("Server> ");
-                memset(buffer, 0, MAX_LINE + 1);
-                if (fgets(buffer, MAX_LINE, stdin) == NULL) {
+                memset(buffer, 0, sizeof(buffer));
+                if (console_read_line("Server> ", buffer, MAX_LINE) == NULL) {
                     break;  // Exit if input fails
                 }
 
@@ -148,30 +177,45 @@ void server(int port) {
                     add_to_history(buffer);
                 } 
                 else {
-                    // Send the command to the client
-                    if (send(new_socket, buffer, strlen(buffer), 0) == -1) {
-                        perror("send error");
+                    // Send the command to the client, or a whole script in a single frame
+                    int sent;
+                    if (strncmp(buffer, "-script ", 8) == 0) {
+                        size_t length;
+                        char *script = read_script(buffer + 8, &length);
+                        if (script == NULL) continue;
+                        if (length + 1 > MAX_FRAME_SIZE) {
+                            printf("Script too large (maximum %d bytes)\n", MAX_FRAME_SIZE);
+                            free(script);
+                            continue;
+                        }
+                        sent = send_frame(new_socket, FRAME_SCRIPT, script, length + 1);
+                        free(script);
+                    } 
+                    else {
+                        sent = send_frame(new_socket, FRAME_COMMAND, buffer, strlen(buffer) + 1);
+                    }
+                    if (sent == -1) {
                         break;
                     }
 
                     // Read the client's response
-                    memset(buffer, 0, MAX_LINE + 1);
-                    int valread = read(new_socket, buffer, MAX_LINE);
+                    Frame frame;
+                    int valread = receive_frame(new_socket, &reader, &frame);
                     if (valread > 0) {
-                        printf("\nClient response: %s\n", buffer);
+                        printf("\nClient response: %s\n", frame.payload);
                     } 
                     else if (valread == 0) {
                         printf("\nClient has closed the connection.\n");
                         break;  // Exit loop if client disconnects
                     } 
                     else {
-                        perror("read error");
                         break;  // Exit loop on read error
                     }
                 }
             }
 
             // Close the client socket after disconnection
+            frame_reader_free(&reader);
             close(new_socket);
             printf("\nReturned to local mode, awaiting new connections or local commands.\n");
         }
@@ -13,8 +13,10 @@
 #define PORT 2580
 #define MAX_CLIENTS 10
 
+extern const char *server_commands[];
+
 void server(int port);
-void multi_server(int port);
+void multi_server(int port, size_t memory_budget, size_t client_cap);
 void exit_server();
 void print_server_help();
 
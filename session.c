@@ -0,0 +1,339 @@
+#include "session.h"
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/random.h>
+
+long session_grace_ms = SESSION_GRACE_MS;
+
+// A response of the client, kept until the server confirms it received it
+typedef struct Response {
+    struct Response *next;
+    unsigned long number;      // Position of the response in the session (from 1)
+    size_t length;             // Length of the payload, null byte included
+    char payload[];
+} Response;
+
+// Client side: the session and the responses it may have to send again
+static char token[SESSION_TOKEN_SIZE];       // Session given by the server ("" if none)
+static char next_token[SESSION_TOKEN_SIZE];  // Session offered after a reconnection, used if the old one is gone
+static int resuming = 0;                     // 1 from a reconnection until the server answers the resume
+static int session_socket = -1;
+static struct timespec lost_at;              // When the connection was lost, until the session is resumed
+static unsigned long commands_received = 0;
+static unsigned long responses_sent = 0;
+static Response *replay_head = NULL;         // Oldest response kept
+static Response *replay_tail = NULL;
+static size_t replay_bytes = 0;
+static size_t replay_limit = SESSION_REPLAY_SIZE;
+
+/**
+ * @brief Reads the session settings from the environment.
+ *
+ * SESSION_GRACE_MS is the time the server keeps the slot of a lost client and the
+ * time the client tries to reconnect (0 disables sessions); CLIENT_REPLAY_BUFFER
+ * bounds the responses a client keeps for a replay.
+ */
+void session_load_config() {
+    const char *value = getenv("SESSION_GRACE_MS");
+    if (value != NULL) {
+        session_grace_ms = atol(value) > 0 ? atol(value) : 0;
+    }
+    value = getenv("CLIENT_REPLAY_BUFFER");
+    if (value != NULL && atol(value) > 0) {
+        replay_limit = atol(value);
+    }
+}
+
+/**
+ * @brief Marks a session whose client did not come back in time (timer callback).
+ */
+static void session_grace_expired(Timer *timer) {
+    ClientInfo *client = timer->data;
+    client->session_expired = 1;
+}
+
+/**
+ * @brief Starts the session of a new connection and gives its token to the client.
+ */
+void session_open(ClientInfo *client) {
+    if (session_grace_ms == 0) return;
+
+    unsigned char bytes[(SESSION_TOKEN_SIZE - 1) / 2];
+    if (getrandom(bytes, sizeof(bytes), 0) != sizeof(bytes)) {
+        perror("getrandom error");
+        return;
+    }
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        snprintf(client->session + 2 * i, 3, "%02x", bytes[i]);
+    }
+    client->commands_sent = 0;
+    client->responses_received = 0;
+    client_send_frame(client, FRAME_SESSION, client->session, strlen(client->session) + 1);
+}
+
+/**
+ * @brief Keeps the slot of a client that lost its connection, in case it comes back.
+ *
+ * The socket and the buffers are released at once; the output log and the
+ * counters of the session stay until the grace timer expires.
+ *
+ * @return 0 if the client may reconnect, -1 if the caller should free the slot.
+ */
+int session_suspend(ClientInfo *client) {
+    if (session_grace_ms == 0 || client->session[0] == '\0') {
+        return -1;
+    }
+
+    client_disconnect(client);
+    client->socket_fd = -1;
+    client->heartbeat.sent_ms = 0;
+    client->heartbeat.missed = 0;
+    client->session_expired = 0;
+    client->grace.callback = session_grace_expired;
+    client->grace.data = client;
+    timer_add(&client->grace, session_grace_ms);
+    return 0;
+}
+
+/**
+ * @brief Gives a connection of the spare slot a short time to resume a session.
+ *
+ * The spare slot is used when every other slot is taken, some by lost clients:
+ * a client coming back must not be refused for lack of room. The connection
+ * gets no session of its own and is closed if it does not resume one in time.
+ */
+void session_await_resume(ClientInfo *client) {
+    client->session_expired = 0;
+    client->grace.callback = session_grace_expired;
+    client->grace.data = client;
+    timer_add(&client->grace, SESSION_RESUME_WAIT_MS);
+}
+
+/**
+ * @brief Moves a new connection into the slot of the session it resumes.
+ *
+ * @param clients The array of clients.
+ * @param num_clients The number of slots in the array.
+ * @param fresh The slot the connection was attached to, freed if the session is found.
+ * @param payload The payload of the resume frame: "<token> <commands received>".
+ * @param lost Receives the number of commands sent in the session that never reached the client.
+ * @return The slot of the session, or -1 if it is unknown or expired (the connection starts a new one).
+ */
+int session_resume(ClientInfo *clients, int num_clients, ClientInfo *fresh, const char *payload,
+                   unsigned long *lost) {
+    char resumed[SESSION_TOKEN_SIZE];
+    unsigned long received = 0;
+    ClientInfo *client = NULL;
+
+    if (sscanf(payload, "%32s %lu", resumed, &received) == 2) {
+        for (int i = 0; i < num_clients; i++) {
+            if (clients[i].socket_fd == -1 && !clients[i].session_expired &&
+                strcmp(clients[i].session, resumed) == 0) {
+                client = &clients[i];
+            }
+        }
+    }
+    if (client == NULL) {
+        client_send_frame(fresh, FRAME_RESUMED, "-1", 3);
+        return -1;
+    }
+
+    // The connection moves, its buffers are already counted in the arena
+    timer_cancel(&client->grace);
+    if (fresh->grace.pending) {
+        timer_cancel(&fresh->grace);
+    }
+    client->socket_fd = fresh->socket_fd;
+    client->address = fresh->address;
+    client->chunks = fresh->chunks;
+    client->in_buf = fresh->in_buf;
+    client->in_len = fresh->in_len;
+    client->in_used = fresh->in_used;
+    client->in_large = fresh->in_large;
+    client->in_large_size = fresh->in_large_size;
+    client->out_head = fresh->out_head;
+    client->out_tail = fresh->out_tail;
+    client->bytes_in += fresh->bytes_in;
+    client->bytes_out += fresh->bytes_out;
+    if (fresh->output.log_size == 0) {
+        unlink(fresh->output.log_path);
+    }
+    output_close(&fresh->output);
+    memset(fresh, 0, sizeof(*fresh));
+
+    // Commands still in the old socket when it broke will never be answered
+    *lost = client->commands_sent > received ? client->commands_sent - received : 0;
+    client->commands_pending = client->commands_pending > (int)*lost ? client->commands_pending - (int)*lost : 0;
+    client->commands_sent = received;
+
+    char answer[32];
+    snprintf(answer, sizeof(answer), "%lu", client->responses_received);
+    client_send_frame(client, FRAME_RESUMED, answer, strlen(answer) + 1);
+    return client - clients;
+}
+
+/**
+ * @brief Forgets the responses the server already has.
+ */
+static void replay_drop(unsigned long last_received) {
+    while (replay_head != NULL && replay_head->number <= last_received) {
+        Response *next = replay_head->next;
+        replay_bytes -= sizeof(Response) + replay_head->length;
+        free(replay_head);
+        replay_head = next;
+    }
+    if (replay_head == NULL) {
+        replay_tail = NULL;
+    }
+}
+
+/**
+ * @brief Handles the session frames of the server (client side).
+ *
+ * @return 1 if the frame was a session frame, 0 if it is not, -1 if an answer could not be sent.
+ */
+int session_client_frame(int sockfd, Frame *frame) {
+    if (frame->type == FRAME_SESSION) {
+        session_socket = sockfd;
+        if (!resuming || token[0] == '\0') {
+            snprintf(token, sizeof(token), "%s", frame->payload);
+            return 1;
+        }
+
+        // Back after losing the connection: kept in case the old session is gone
+        snprintf(next_token, sizeof(next_token), "%s", frame->payload);
+        return 1;
+    }
+
+    if (frame->type == FRAME_RESUMED) {
+        long received = atol(frame->payload);
+        resuming = 0;
+        lost_at.tv_sec = 0;
+        if (received < 0) {
+            printf("\nThe server no longer knows the session, responses it did not receive are lost\n");
+            snprintf(token, sizeof(token), "%s", next_token);
+            commands_received = 0;
+            responses_sent = 0;
+            replay_drop(ULONG_MAX);
+            return 1;
+        }
+
+        replay_drop(received);
+        unsigned long expected = received + 1;
+        if (replay_head != NULL && replay_head->number > expected) {
+            printf("\n%lu response(s) no longer in the replay buffer are lost\n", replay_head->number - expected);
+        }
+        int replayed = 0;
+        for (Response *response = replay_head; response != NULL; response = response->next) {
+            if (send_frame(sockfd, FRAME_RESPONSE, response->payload, response->length) == -1) {
+                return -1;
+            }
+            replayed++;
+        }
+        printf("\nSession resumed, %d response(s) sent again\n", replayed);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Counts a command or a script received from the server.
+ */
+void session_command_received() {
+    commands_received++;
+}
+
+/**
+ * @brief Sends a response to the server, keeping it until the server is known to have it.
+ *
+ * The oldest responses are dropped when the replay buffer is full. Without a
+ * session (or with the server not answering yet), the response is only kept.
+ *
+ * @return 0 on success, -1 if the connection is lost.
+ */
+int session_send_response(int sockfd, const char *response, size_t length) {
+    if (token[0] != '\0') {
+        Response *kept = malloc(sizeof(Response) + length);
+        kept->next = NULL;
+        kept->number = ++responses_sent;
+        kept->length = length;
+        memcpy(kept->payload, response, length);
+        if (replay_tail != NULL) {
+            replay_tail->next = kept;
+        } else {
+            replay_head = kept;
+        }
+        replay_tail = kept;
+        replay_bytes += sizeof(Response) + length;
+
+        while (replay_bytes > replay_limit && replay_head != replay_tail) {
+            replay_drop(replay_head->number);
+        }
+        if (resuming) {
+            return 0;  // Sent with the others once the server answers the resume
+        }
+    }
+    return send_frame(sockfd, FRAME_RESPONSE, response, length);
+}
+
+/**
+ * @brief Connects to the server again after losing the connection, within the grace window.
+ *
+ * @return The new socket, or -1 if there is no session or the server stayed out of reach.
+ */
+int session_reconnect(struct sockaddr_in *address) {
+    if (session_grace_ms == 0 || token[0] == '\0') {
+        return -1;
+    }
+
+    // The window starts at the first loss: a server that keeps dropping the connection does not extend it
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (lost_at.tv_sec == 0) {
+        lost_at = now;
+    }
+    long delay_ms = SESSION_RETRY_MS;
+    long elapsed_ms = (now.tv_sec - lost_at.tv_sec) * 1000 + (now.tv_nsec - lost_at.tv_nsec) / 1000000;
+    printf("Reconnecting to the server for up to %ld ms...\n", session_grace_ms - elapsed_ms);
+    fflush(stdout);
+
+    while (elapsed_ms < session_grace_ms) {
+        int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        if (sockfd < 0) {
+            perror("socket error");
+            return -1;
+        }
+        if (connect(sockfd, (struct sockaddr *)address, sizeof(*address)) == 0) {
+            // Asked at once: with every slot taken, the server only keeps the connection to resume
+            char request[SESSION_TOKEN_SIZE + 32];
+            snprintf(request, sizeof(request), "%s %lu", token, commands_received);
+            if (send_frame(sockfd, FRAME_RESUME, request, strlen(request) + 1) == 0) {
+                printf("Connection established with the server again\n");
+                resuming = 1;
+                next_token[0] = '\0';
+                session_socket = sockfd;
+                return sockfd;
+            }
+        }
+        close(sockfd);
+
+        struct timespec pause = {delay_ms / 1000, (delay_ms % 1000) * 1000000};
+        while (nanosleep(&pause, &pause) == -1 && errno == EINTR);
+        delay_ms = delay_ms * 2 < 2000 ? delay_ms * 2 : 2000;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed_ms = (now.tv_sec - lost_at.tv_sec) * 1000 + (now.tv_nsec - lost_at.tv_nsec) / 1000000;
+    }
+    printf("The server did not come back\n");
+    return -1;
+}
+
+/**
+ * @brief Tells the server the client leaves for good, so its slot is freed at once.
+ */
+void session_client_close() {
+    if (session_socket != -1 && token[0] != '\0') {
+        send_frame(session_socket, FRAME_CLOSE, "", 1);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "client_pool.h"
+
+#define SESSION_GRACE_MS 30000           // Default time a client has to reconnect (SESSION_GRACE_MS overrides it, 0 disables)
+#define SESSION_REPLAY_SIZE (64 * 1024)  // Default bytes of responses a client keeps for a replay (CLIENT_REPLAY_BUFFER)
+#define SESSION_RESUME_WAIT_MS 2000      // Time a connection in the spare slot has to resume a session
+#define SESSION_RETRY_MS 100             // First delay between two reconnection attempts, doubled up to 2 s
+
+extern long session_grace_ms;
+
+void session_load_config();
+
+// Server side
+void session_open(ClientInfo *client);
+int session_suspend(ClientInfo *client);
+void session_await_resume(ClientInfo *client);
+int session_resume(ClientInfo *clients, int num_clients, ClientInfo *fresh, const char *payload,
+                   unsigned long *lost);
+
+// Client side
+int session_client_frame(int sockfd, Frame *frame);
+void session_command_received();
+int session_send_response(int sockfd, const char *response, size_t length);
+int session_reconnect(struct sockaddr_in *address);
+void session_client_close();
+
+#endif
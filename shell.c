@@ -1,4 +1,13 @@
 #include "shell.h"
+#include "parallel.h"
+#include "timeout.h"
+#include "limits.h"
+#include "variables.h"
+#include "globbing.h"
+#include "heredoc.h"
+#include "trace.h"
+#include "zygote.h"
+#include "console.h"
 
 // History of commands entered in the shell
 char *history[MAX_HISTORY];
@@ -9,31 +18,109 @@ char *args[MAX_LINE / 2 + 1];
 char cwd[MAX_LINE];  // Current working directory
 char line[MAX_LINE];  // Line entered by the user
 
+/**
+ * @brief Reads a command line, running the timers of background commands meanwhile.
+ *
+ * The line ends with a newline like with console_read_line().
+ *
+ * @return The line, or NULL at the end of the input.
+ */
+static char *read_command_line(const char *prompt, char *buffer, size_t size) {
+    int timer_fd = timer_wheel_fd();
+    if (timer_fd == -1) {
+        return console_read_line(prompt, buffer, size);
+    }
+
+    console_prompt(prompt);
+    while (1) {
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(STDIN_FILENO, &readfds);
+        FD_SET(timer_fd, &readfds);
+        int max_fd = timer_fd > STDIN_FILENO ? timer_fd : STDIN_FILENO;
+
+        if (select(max_fd + 1, &readfds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR) continue;
+            perror("select error");
+            return NULL;
+        }
+        if (FD_ISSET(timer_fd, &readfds)) {
+            timer_wheel_process();
+        }
+        if (FD_ISSET(STDIN_FILENO, &readfds)) {
+            int ready = console_line_ready(buffer, size);
+            if (ready == 1) return buffer;
+            if (ready == -1) return NULL;
+        }
+    }
+}
+
 /**
  * @brief Starts the shell loop, continuously reading user input.
  */
 void shell() {
+    limits_load_config();
+
     // Set up a signal handler for Ctrl+C (SIGINT)
     signal(SIGINT, handle_sigint);
     signal(SIGTSTP, handle_sigtstp);
     signal(SIGTERM, handle_sigterm);
+    console_init(NULL, NULL, 0);
 
     while (1) {
         // Print the current directory as a prompt
-        printf("%s> ", get_path());
+        char prompt[MAX_LINE + 3];
+        snprintf(prompt, sizeof(prompt), "%s> ", get_path());
 
-        // Read the user input
-        if (fgets(line, MAX_LINE, stdin) == NULL) {
+        // Read the user input (timeouts of background commands expire while waiting)
+        if (read_command_line(prompt, line, MAX_LINE) == NULL) {
             break;  // End of input or error
         } 
+        else if (heredoc_incomplete(line)) {
+            // Here-document: keep reading until its delimiter line
+            char *script = read_heredoc_lines(line);
+            add_to_history(script);
+            execute_command(script);
+            free(script);
+            printf("\n");
+        } 
         else {
             add_to_history(line);  // Add the command to history
+            if (trace_enabled) {
+                trace_set_id(trace_new_id());  // One trace per command line
+            }
             execute_command(line);  // Execute the command entered
+            trace_flush();
             printf("\n");
         }
     }    
 }
 
+/**
+ * @brief Reads the lines following a command until its here-documents are complete.
+ *
+ * @param first The line holding the command.
+ * @return The command followed by the bodies, to be freed by the caller.
+ */
+char *read_heredoc_lines(const char *first) {
+    size_t length = strlen(first);
+    size_t capacity = length + MAX_LINE + 1;
+    char *script = malloc(capacity);
+    memcpy(script, first, length + 1);
+
+    while (heredoc_incomplete(script)) {
+        if (capacity - length <= MAX_LINE) {
+            capacity *= 2;
+            script = realloc(script, capacity);
+        }
+        if (console_read_line("> ", script + length, MAX_LINE) == NULL) {
+            break;  // The end of the input also ends the body
+        }
+        length += strlen(script + length);
+    }
+    return script;
+}
+
 /**
  * @brief Handles the Ctrl+C (SIGINT) signal to prevent shell termination.
  */
@@ -115,125 +202,281 @@ void clear_history() {
 }
 
 /**
- * @brief Executes a command entered by the user.
+ * @brief Executes a command entered by the user or received from the server.
+ *
+ * The command may span several lines: each line is executed in turn, and a line
+ * using here-documents takes their bodies from the lines that follow it.
  * 
  * @param command The command to be executed.
+ * @return The exit status of the last foreground command (0 on success),
+ *         or -1 if the shell itself could not run the command.
+ */
+int execute_command(char *command) {
+    char *cursor = command;
+    char *current_line;
+    int status = 0;
+
+    while ((current_line = heredoc_next_line(&cursor)) != NULL) {
+        if (current_line[strspn(current_line, " \t\r\n")] == '\0') continue;  // Blank line
+        status = execute_line(current_line);
+    }
+    return status;
+}
+
+/**
+ * @brief Executes a single command line (with the bodies of its here-documents).
+ * 
+ * @param command The command line to be executed.
+ * @return The exit status of the last foreground command (0 on success),
+ *         or -1 if the shell itself could not run the command.
  */
-void execute_command(char *command) {
+int execute_line(char *command) {
     char *commands[MAX_LINE];
     char *token;
-    char *saveptr;
+    char *line_cursor = command;
     int fd;
     int background = 0;
     int num_pipes = 0;
     int i = 0;
+    int status = 0;
+
+    command_timed_out = 0;
+    glob_reset();  // Directory listings are only cached for one command line
+    memset(&last_command_usage, 0, sizeof(last_command_usage));
+    last_command_usage.peak_pids = -1;
+    if (heredoc_prepare(command) < 0) {
+        return -1;
+    }
 
-    // Split the command into sub-commands using the '&&' delimiter
-    token = strtok_r(command, "&&", &saveptr);
+    // Split the command into sub-commands using the '&&' delimiter (outside quotes)
+    token = next_part(&line_cursor, "&&");
     while (token != NULL) {
         commands[num_pipes++] = token;
-        token = strtok_r(NULL, "&&", &saveptr);
+        token = next_part(&line_cursor, "&&");
     }
     commands[num_pipes] = NULL;
 
     for (i = 0; i < num_pipes; i++) {
         char *current_command = commands[i];
 
-        // Split the current command into sub-commands using the '|' delimiter
+        // Optional prefixes, in any order:
+        // "timeout <seconds>" runs the pipeline in its own process group with a deadline,
+        // "limit ..." runs it with resource limits (added to the client's ones for server commands)
+        long timeout_ms = 0;
+        ResourceLimits limits = {0};
+        if (use_default_limits) {
+            limits = default_limits;
+        }
+        while (1) {
+            long parsed_timeout = parse_timeout(&current_command);
+            int parsed_limits = parse_limits(&current_command, &limits);
+            if (parsed_timeout < 0 || parsed_limits < 0) {
+                return -1;
+            }
+            if (parsed_timeout > 0) {
+                timeout_ms = parsed_timeout;
+            }
+            if (parsed_timeout == 0 && parsed_limits == 0) break;
+        }
+        int limited = limits_enabled(&limits);
+        int limits_ready = 0;
+
+        // The parallel builtin uses the rest of the line (pipes included) as its template
+        char *producer;
+        char *parallel_stage = find_parallel_stage(current_command, &producer);
+        if (parallel_stage != NULL) {
+            status = run_parallel(producer, parallel_stage, timeout_ms, &limits);
+            continue;
+        }
+
+        // Split the current command into sub-commands using the '|' delimiter (outside quotes)
         char *pipe_commands[MAX_LINE];
         char *pipe_token;
-        char *pipe_saveptr;
+        char *pipe_cursor = current_command;
         int num_pipe_cmds = 0;
 
-        pipe_token = strtok_r(current_command, "|", &pipe_saveptr);
+        pipe_token = next_part(&pipe_cursor, "|");
         while (pipe_token != NULL) {
             pipe_commands[num_pipe_cmds++] = pipe_token;
-            pipe_token = strtok_r(NULL, "|", &pipe_saveptr);
+            pipe_token = next_part(&pipe_cursor, "|");
         }
         pipe_commands[num_pipe_cmds] = NULL;
 
+        int stdout_copy = dup(STDOUT_FILENO);  // Save original stdout
+        int stdin_copy = dup(STDIN_FILENO);    // Save original stdin
+        int aborted = 0;  // Set by an error: what was started is stopped and the line ends
+
         int pipefd[2 * (num_pipe_cmds - 1)];
+        int num_pipe_fds = 0;
         for (int j = 0; j < num_pipe_cmds - 1; j++) {
             if (pipe(pipefd + j * 2) < 0) {
                 perror("pipe error");
-                return;
+                status = -1;
+                aborted = 1;
+                break;
             }
+            num_pipe_fds += 2;
         }
-
-        int stdout_copy = dup(STDOUT_FILENO);  // Save original stdout
-        int stdin_copy = dup(STDIN_FILENO);    // Save original stdin
+        pid_t last_pid = -1;  // Last process of the pipeline, gives the exit status
+        pid_t pids[num_pipe_cmds];  // Processes of the pipeline
+        int num_pids = 0;
+        pid_t pgid = 0;  // Process group of the pipeline when it has a timeout
+        long long run_start = 0;  // First process started, for the "exit" span
+        int helper = -1;  // Zygote helper running the command instead of a child of the shell
 
         int j = 0;
-        for (j = 0; j < num_pipe_cmds; j++) {
-            // Tokenize each sub-command to get the arguments
-            char *sub_args[MAX_LINE / 2 + 1];
+        for (j = 0; j < num_pipe_cmds && !aborted; j++) {
+            long long parse_start = TRACE_START();
+
+            // Tokenize each sub-command to get the arguments (quoted spaces stay in the word)
+            char *sub_args[MAX_ARGS + 1];
+            char *assignments[MAX_LINE / 2 + 1];  // "NAME=value" words before the command
+            char expansions[MAX_LINE * 4];         // Storage for the expanded words
+            char *pool = expansions;
+            char *pool_end = expansions + sizeof(expansions);
             char *sub_token;
-            char *sub_saveptr;
+            char *cursor = pipe_commands[j];
             int arg_index = 0;
+            int num_assignments = 0;
 
-            sub_token = strtok_r(pipe_commands[j], " \t\n", &sub_saveptr);
+            sub_token = next_word(&cursor);
             while (sub_token != NULL) {
-                // Check if it is an environment variable to evaluate
-                if (sub_token[0] == '$') {
-                    char *env_value = getenv(sub_token + 1);
-                    if (env_value) {
-                        sub_args[arg_index++] = env_value;
-                    } else {
-                        printf("Undefined environment variable: %s\n", sub_token);
-                        return;
-                    }
-                } 
-                else if (strcmp(sub_token, "&") == 0) {
+                if (strcmp(sub_token, "&") == 0) {
                     // Handle background processes
                     background = 1;
                 } 
-                else if (strcmp(sub_token, ">") == 0) {
-                    // Output redirection
-                    sub_token = strtok_r(NULL, " \t\n", &sub_saveptr);
-                    fd = open(sub_token, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    if (fd == -1) {
-                        perror("open error");
-                        return;
+                else if (strncmp(sub_token, "<<", 2) == 0) {
+                    // Here-document (<<, <<-) or here-string (<<<), given to the command on stdin
+                    int here_string = (sub_token[2] == '<');
+                    char *operator = sub_token;
+                    char *word = sub_token + (here_string || sub_token[2] == '-' ? 3 : 2);
+                    if (*word == '\0') {
+                        word = next_word(&cursor);
+                    }
+                    if (word == NULL) {
+                        printf("Missing word after %s\n", operator);
+                        status = -1;
+                        aborted = 1;
+                        break;
+                    }
+
+                    if (here_string) {
+                        char *text = expand_word(word, &pool, pool_end, NULL);
+                        fd = text != NULL ? heredoc_open_string(text) : -1;
+                    } 
+                    else {
+                        fd = heredoc_open_next();
                     }
-                    dup2(fd, STDOUT_FILENO);
-                    close(fd);
-                } 
-                else if (strcmp(sub_token, ">>") == 0) {
-                    // Output redirection in append mode
-                    sub_token = strtok_r(NULL, " \t\n", &sub_saveptr);
-                    fd = open(sub_token, O_WRONLY | O_CREAT | O_APPEND, 0644);
                     if (fd == -1) {
-                        perror("open error");
-                        return;
+                        status = -1;
+                        aborted = 1;
+                        break;
                     }
-                    dup2(fd, STDOUT_FILENO);
+                    dup2(fd, STDIN_FILENO);
                     close(fd);
                 } 
-                else if (strcmp(sub_token, "<") == 0) {
-                    // Input redirection
-                    sub_token = strtok_r(NULL, " \t\n", &sub_saveptr);
-                    fd = open(sub_token, O_RDONLY);
+                else if (strcmp(sub_token, ">") == 0 || strcmp(sub_token, ">>") == 0 || strcmp(sub_token, "<") == 0) {
+                    // Redirections: the file name is expanded like any other word
+                    char *operator = sub_token;
+                    sub_token = next_word(&cursor);
+                    char *target = sub_token != NULL ? expand_word(sub_token, &pool, pool_end, NULL) : NULL;
+                    if (target == NULL) {
+                        printf("Missing file name after %s\n", operator);
+                        status = -1;
+                        aborted = 1;
+                        break;
+                    }
+
+                    if (strcmp(operator, ">") == 0) {
+                        // Output redirection
+                        fd = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                    } 
+                    else if (strcmp(operator, ">>") == 0) {
+                        // Output redirection in append mode
+                        fd = open(target, O_WRONLY | O_CREAT | O_APPEND, 0644);
+                    } 
+                    else {
+                        // Input redirection
+                        fd = open(target, O_RDONLY);
+                    }
                     if (fd == -1) {
                         perror("open error");
-                        return;
+                        status = -1;
+                        aborted = 1;
+                        break;
                     }
-                    dup2(fd, STDIN_FILENO);
+                    dup2(fd, operator[0] == '<' ? STDIN_FILENO : STDOUT_FILENO);
                     close(fd);
                 } 
                 else {
-                    sub_args[arg_index++] = sub_token;
+                    // Expand the variables ($NAME, ${NAME}, $?) and remove the quotes
+                    int pattern = 0;
+                    char *word = expand_word(sub_token, &pool, pool_end, &pattern);
+                    if (word == NULL) {
+                        printf("Command too long after expansion\n");
+                        status = -1;
+                        aborted = 1;
+                        break;
+                    }
+                    if (arg_index == 0 && is_assignment(sub_token)) {
+                        glob_unescape(word);
+                        assignments[num_assignments++] = word;
+                    } 
+                    else if (arg_index >= MAX_ARGS) {
+                        printf("Too many arguments\n");
+                        status = -1;
+                        aborted = 1;
+                        break;
+                    } 
+                    else if (pattern) {
+                        // Pathname expansion, the pattern is kept as is when nothing matches
+                        int found = glob_expand(word, sub_args + arg_index, MAX_ARGS - arg_index);
+                        if (found < 0) {
+                            printf("Too many arguments after expanding %s\n", sub_token);
+                            status = -1;
+                            aborted = 1;
+                            break;
+                        }
+                        if (found == 0) {
+                            glob_unescape(word);
+                            sub_args[arg_index++] = word;
+                        }
+                        arg_index += found;
+                    } 
+                    else {
+                        sub_args[arg_index++] = word;
+                    }
                 }
-                sub_token = strtok_r(NULL, " \t\n", &sub_saveptr);
+                sub_token = next_word(&cursor);
             }
+            if (aborted) break;
             sub_args[arg_index] = NULL;
 
-            if (arg_index == 0) return;
+            if (arg_index == 0) {
+                // Only assignments: set shell variables
+                for (int k = 0; k < num_assignments; k++) {
+                    char *equal = strchr(assignments[k], '=');
+                    *equal = '\0';
+                    variable_set(assignments[k], equal + 1, 0);
+                }
+                if (num_assignments > 0) continue;
+                aborted = 1;  // Nothing to run, the line ends here
+                break;
+            }
 
-            // Handle internal commands (cd, help, history, exit)
+            // Handle internal commands (cd, export, unset, help, history, exit)
             if (strcmp(sub_args[0], "cd") == 0) {
                 change_directory(sub_args);
                 continue;
             } 
+            else if (strcmp(sub_args[0], "export") == 0) {
+                export_command(sub_args);
+                continue;
+            } 
+            else if (strcmp(sub_args[0], "unset") == 0) {
+                unset_command(sub_args);
+                continue;
+            } 
             else if (strcmp(sub_args[0], "help") == 0) {
                 print_help();
                 continue;
@@ -246,8 +489,35 @@ void execute_command(char *command) {
                 exit_shell();
             }
             
+            // The leaf cgroup is only created once a process is really started
+            if (limited && !limits_ready) {
+                limits_prepare(&limits);
+                limits_ready = 1;
+            }
+
+            TRACE_END("parse", parse_start);
+            long long spawn_start = TRACE_START();
+
+            // A simple foreground command can be started by a zygote helper, the shell does not fork
+            if (num_pipe_cmds == 1 && !background && timeout_ms == 0 && !limited && num_assignments == 0) {
+                helper = zygote_spawn(sub_args, variables_environ());
+                if (helper != -1) {
+                    TRACE_END("spawn", spawn_start);
+                    run_start = spawn_start;
+                    continue;
+                }
+            }
+
             pid_t pid = fork();
             if (pid == 0) {
+                // Join the process group of the pipeline so the timeout can kill all of it
+                if (timeout_ms > 0) {
+                    setpgid(0, pgid);
+                }
+                if (limited) {
+                    limits_apply_child(&limits);
+                }
+
                 // Redirect pipes
                 if (j != 0) {
                     dup2(pipefd[(j - 1) * 2], 0);
@@ -261,32 +531,155 @@ void execute_command(char *command) {
                     close(pipefd[k]);
                 }
 
+                // Assignments before the command only apply to it
+                for (int k = 0; k < num_assignments; k++) {
+                    char *equal = strchr(assignments[k], '=');
+                    *equal = '\0';
+                    variable_set(assignments[k], equal + 1, 1);
+                }
+                environ = variables_environ();
+
                 execvp(sub_args[0], sub_args);
                 perror("execvp error"); // In case of failure
                 exit(EXIT_FAILURE);
             } 
             else if (pid < 0) {
                 perror("fork error");
-                return;
+                status = -1;
+                aborted = 1;
+                break;
             }
+            TRACE_END("spawn", spawn_start);
+            if (run_start == 0) {
+                run_start = spawn_start;
+            }
+            if (timeout_ms > 0) {
+                if (pgid == 0) pgid = pid;
+                setpgid(pid, pgid);
+            }
+            pids[num_pids++] = pid;
+            last_pid = pid;
         }
 
         // Close all file descriptors in the parent process
-        for (int k = 0; k < 2 * (num_pipe_cmds - 1); k++) {
+        for (int k = 0; k < num_pipe_fds; k++) {
             close(pipefd[k]);
         }
 
-        // Wait for all child processes
-        for (int k = 0; k < num_pipe_cmds; k++) {
-            if (!background) {
-                wait(NULL);
+        if (aborted) {
+            // The stages already started are stopped, so their cgroup can be removed
+            for (int k = 0; k < num_pids; k++) {
+                kill(pids[k], SIGKILL);
+                waitpid(pids[k], NULL, 0);
+            }
+        }
+        else if (timeout_ms > 0 && num_pids > 0) {
+            if (background) {
+                // The timer outlives this call, it frees itself once expired
+                JobTimeout *job = malloc(sizeof(JobTimeout));
+                timeout_start(job, pgid, timeout_ms, 1);
+            }
+            else {
+                // Wait for the pipeline while the timer wheel runs
+                JobTimeout job;
+                timeout_start(&job, pgid, timeout_ms, 0);
+                status = wait_pipeline(pids, num_pids, last_pid);
+                timer_cancel(&job.timer);
+                if (job.signal_sent != 0) {
+                    command_timed_out = 1;
+                    status = TIMEOUT_STATUS;
+                }
+            }
+        }
+        else if (helper != -1) {
+            // The helper waited for the command and sends its status
+            int wstatus;
+            struct rusage usage;
+            zygote_wait(helper, &wstatus, &usage);
+            account_child(&usage);
+            status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+        }
+        else {
+            // Wait for all child processes
+            for (int k = 0; k < num_pipe_cmds; k++) {
+                if (!background) {
+                    int wstatus;
+                    struct rusage usage;
+                    pid_t done = wait4(-1, &wstatus, 0, &usage);
+                    if (done > 0) {
+                        account_child(&usage);
+                    }
+                    if (done == last_pid) {
+                        // Report the status like a shell would: exit code or 128 + signal
+                        status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+                    }
+                }
             }
         }
 
+        if (!background && !aborted) {
+            TRACE_END("exit", run_start);
+        }
+
+        // Read the peak usage of the pipeline (background pipelines keep their cgroup)
+        if (limits_ready && (!background || aborted)) {
+            limits_finish(&limits);
+        }
+
         // Restore original stdout and stdin
         dup2(stdout_copy, STDOUT_FILENO);
         dup2(stdin_copy, STDIN_FILENO);
+        close(stdout_copy);
+        close(stdin_copy);
+        if (aborted) {
+            return status;
+        }
+        last_status = status;
+    }
+
+    last_status = status;
+    return status;
+}
+
+/**
+ * @brief Builds the command of an item by replacing every '{}' of a template.
+ *
+ * If the template contains no '{}', the item is appended at the end of the command
+ * (same behaviour as GNU parallel).
+ *
+ * @param template The command template.
+ * @param input The input line of the item.
+ * @param command Buffer receiving the command.
+ * @param size Size of the buffer.
+ * @return 0 on success, -1 if the command does not fit in the buffer.
+ */
+int substitute_item(const char *template, const char *input, char *command, size_t size) {
+    size_t length = 0;
+    size_t input_length = strlen(input);
+    int replaced = 0;
+
+    for (const char *p = template; *p != '\0'; p++) {
+        if (p[0] == '{' && p[1] == '}') {
+            if (length + input_length >= size) return -1;
+            memcpy(command + length, input, input_length);
+            length += input_length;
+            replaced = 1;
+            p++;  // Skip the closing brace
+        } else {
+            if (length + 1 >= size) return -1;
+            command[length++] = *p;
+        }
     }
+
+    if (!replaced) {
+        if (length + input_length + 1 >= size) return -1;
+        command[length++] = ' ';
+        memcpy(command + length, input, input_length);
+        length += input_length;
+    }
+
+    command[length] = '\0';
+    return 0;
 }
 
 /**
@@ -295,6 +688,12 @@ void execute_command(char *command) {
 void print_help() {
     printf("List of available commands:\n");
     printf("    history : Show command history\n");
+    printf("    timeout <seconds> <cmd> : Kill the command (SIGTERM, then SIGKILL) if it runs too long\n");
+    printf("    limit [mem=<size>] [cpu=<weight>] [pids=<n>] <cmd> : Run the command with resource limits\n");
+    printf("    NAME=value : Set a shell variable ($NAME, ${NAME} and $? are expanded in words)\n");
+    printf("    export NAME[=value] / unset NAME : Export a variable to the commands / remove it\n");
+    printf("    <cmd> <<WORD / <<-WORD / <<< word : Give the following lines (up to WORD) or a word to the command\n");
+    printf("    parallel [-j N] <cmd with {}> : Run the command for each line of stdin on N jobs\n");
     printf("    exit : Exit the shell\n");
     printf("    help : Display this help message\n");
     printf("    help_server : Display help message for the server\n");
@@ -317,7 +716,8 @@ void exit_shell() {
  */
 void change_directory(char **args) {
     if (args[1] == NULL) {
-        if (chdir(getenv("HOME")) != 0) {
+        char *home = variable_get("HOME");
+        if (home == NULL || chdir(home) != 0) {
             perror("chdir error");
         }
     } else {
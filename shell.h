@@ -10,8 +10,11 @@
 #include <signal.h>
 #include <errno.h>
 
+extern char **environ;
+
 #define MAX_LINE 1024
 #define MAX_HISTORY 10
+#define MAX_ARGS 16384  // Arguments of a command, after pathname expansion
 #define AUTORIZATIONS (O_WRONLY | O_CREAT | O_APPEND)
 
 void shell();
@@ -21,11 +24,14 @@ void handle_sigterm(int sig);
 void add_to_history(char *command);
 void print_history();
 void clear_history();
-void execute_command(char *command);
+int execute_command(char *command);
+int execute_line(char *command);
+char *read_heredoc_lines(const char *first);
 void print_help();
 void exit_shell();
 void change_directory(char **args);
 char *get_path();
+int substitute_item(const char *template, const char *input, char *command, size_t size);
 
 
 #endif
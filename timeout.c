@@ -0,0 +1,161 @@
+#include "timeout.h"
+#include "limits.h"
+#include <math.h>
+#include <poll.h>
+#include <sys/syscall.h>
+
+// Set by execute_command() when the last command was killed by its timeout
+int command_timed_out = 0;
+
+/**
+ * @brief Escalates an expired timeout: SIGTERM first, then SIGKILL if the group is still alive.
+ */
+static void timeout_expired(Timer *timer) {
+    JobTimeout *job = timer->data;
+
+    if (job->background) {
+        // Nobody waits for background jobs: reap what already ended in the group
+        while (waitpid(-job->pgid, NULL, WNOHANG) > 0);
+    }
+
+    if (job->signal_sent == 0) {
+        if (kill(-job->pgid, SIGTERM) == 0) {
+            printf("\nCommand timed out, SIGTERM sent to process group %d\n", job->pgid);
+            fflush(stdout);
+            job->signal_sent = SIGTERM;
+            timer_add(timer, TIMEOUT_KILL_DELAY_MS);
+            return;
+        }
+    }
+    else if (job->signal_sent == SIGTERM) {
+        if (kill(-job->pgid, SIGKILL) == 0) {
+            printf("\nProcess group %d still alive, SIGKILL sent\n", job->pgid);
+            fflush(stdout);
+            job->signal_sent = SIGKILL;
+        }
+    }
+
+    if (job->background) {
+        free(job);
+    }
+}
+
+/**
+ * @brief Parses a "timeout <seconds>" prefix at the start of a command.
+ *
+ * The delay must be a positive number of seconds within the range of the timer
+ * wheel (about 7 hours).
+ *
+ * @param command The command, advanced past the prefix if there is one.
+ * @return The timeout in milliseconds, 0 if there is no prefix, -1 if it is invalid.
+ */
+long parse_timeout(char **command) {
+    char *start = *command;
+    while (*start == ' ' || *start == '\t') start++;
+
+    if (strncmp(start, "timeout", 7) != 0 || (start[7] != ' ' && start[7] != '\t')) {
+        return 0;
+    }
+
+    char *end;
+    double seconds = strtod(start + 7, &end);
+    if (end == start + 7 || !isfinite(seconds) || seconds <= 0 || seconds * 1000 > WHEEL_MAX_MS) {
+        printf("Usage: timeout <seconds> <command> (0 < seconds <= %ld)\n", WHEEL_MAX_MS / 1000);
+        return -1;
+    }
+
+    *command = end;
+    long timeout_ms = (long)(seconds * 1000);
+    return timeout_ms > 0 ? timeout_ms : 1;  // A delay below 1 ms still sets a timeout
+}
+
+/**
+ * @brief Starts the timer of a pipeline.
+ *
+ * @param job The timeout (allocated with malloc() for background jobs, it is freed once expired).
+ * @param pgid The process group of the pipeline.
+ * @param timeout_ms The delay before the group receives SIGTERM.
+ * @param background 1 if nobody waits for the pipeline.
+ */
+void timeout_start(JobTimeout *job, pid_t pgid, long timeout_ms, int background) {
+    memset(job, 0, sizeof(*job));
+    job->pgid = pgid;
+    job->background = background;
+    job->timer.callback = timeout_expired;
+    job->timer.data = job;
+    timer_add(&job->timer, timeout_ms);
+}
+
+/**
+ * @brief Waits for the processes of a pipeline while running the timers.
+ *
+ * Each process is watched through a pidfd, so the wait can be interrupted by
+ * the ticks of the timer wheel instead of blocking in wait().
+ *
+ * @param pids The processes of the pipeline.
+ * @param count The number of processes.
+ * @param last_pid The last process, which gives the status of the pipeline.
+ * @return The exit status of the last process.
+ */
+int wait_pipeline(pid_t *pids, int count, pid_t last_pid) {
+    struct pollfd fds[count + 1];
+    pid_t watched[count + 1];
+    int remaining = 0;
+    int status = 0;
+    int wstatus;
+
+    fds[0].fd = timer_wheel_fd();
+    fds[0].events = POLLIN;
+
+    for (int i = 0; i < count; i++) {
+        int pidfd = syscall(SYS_pidfd_open, pids[i], 0);
+        if (pidfd < 0) {
+            // Without pidfd the process can only be waited for normally
+            struct rusage usage;
+            if (wait4(pids[i], &wstatus, 0, &usage) > 0) {
+                account_child(&usage);
+            }
+            if (pids[i] == last_pid) {
+                status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+            }
+            continue;
+        }
+        remaining++;
+        fds[remaining].fd = pidfd;
+        fds[remaining].events = POLLIN;
+        watched[remaining] = pids[i];
+    }
+
+    while (remaining > 0) {
+        if (poll(fds, remaining + 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll error");
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            timer_wheel_process();
+        }
+
+        for (int i = 1; i <= remaining; i++) {
+            if (!(fds[i].revents & POLLIN)) continue;
+
+            struct rusage usage;
+            if (wait4(watched[i], &wstatus, 0, &usage) > 0) {
+                account_child(&usage);
+            }
+            if (watched[i] == last_pid) {
+                status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+            }
+            close(fds[i].fd);
+
+            // Replace the entry by the last one and check it again
+            fds[i] = fds[remaining];
+            watched[i] = watched[remaining];
+            remaining--;
+            i--;
+        }
+    }
+
+    return status;
+}
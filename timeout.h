@@ -0,0 +1,24 @@
+#ifndef TIMEOUT_H
+#define TIMEOUT_H
+
+#include "shell.h"
+#include "timer_wheel.h"
+
+#define TIMEOUT_STATUS 124           // Status of a command killed by its timeout (same as timeout(1))
+#define TIMEOUT_KILL_DELAY_MS 2000   // Delay between SIGTERM and SIGKILL
+
+// Deadline of a pipeline running in its own process group
+typedef struct {
+    Timer timer;
+    pid_t pgid;         // Process group of the pipeline
+    int signal_sent;    // 0, SIGTERM or SIGKILL
+    int background;     // 1 if the structure was allocated for a background job
+} JobTimeout;
+
+extern int command_timed_out;
+
+long parse_timeout(char **command);
+void timeout_start(JobTimeout *job, pid_t pgid, long timeout_ms, int background);
+int wait_pipeline(pid_t *pids, int count, pid_t last_pid);
+
+#endif
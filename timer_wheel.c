@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "timer_wheel.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+// Hierarchical timer wheel driven by a single timerfd ticking every WHEEL_TICK_MS.
+// Adding, cancelling and expiring a timer is O(1), whatever the number of timers.
+static struct {
+    int fd;                                   // timerfd (-1 until first used)
+    unsigned long now;                        // Current tick
+    int count;                                // Number of pending timers
+    Timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} wheel = { .fd = -1 };
+
+/**
+ * @brief Starts or stops the periodic tick of the timerfd.
+ *
+ * The timerfd only ticks while timers are pending, so an idle process is never woken up.
+ */
+static void wheel_arm(int enable) {
+    struct itimerspec spec = {0};
+    if (enable) {
+        spec.it_interval.tv_nsec = WHEEL_TICK_MS * 1000000L;
+        spec.it_value = spec.it_interval;
+    }
+    if (timerfd_settime(wheel.fd, 0, &spec, NULL) < 0) {
+        perror("timerfd_settime error");
+    }
+}
+
+/**
+ * @brief Puts a timer in the slot matching its distance to the current tick.
+ */
+static void wheel_insert(Timer *timer) {
+    unsigned long delta = timer->expires - wheel.now;
+    int level;
+    int slot;
+
+    if (delta < WHEEL_SLOTS) {
+        level = 0;
+        slot = timer->expires & WHEEL_MASK;
+    }
+    else if (delta < (1UL << (2 * WHEEL_BITS))) {
+        level = 1;
+        slot = (timer->expires >> WHEEL_BITS) & WHEEL_MASK;
+    }
+    else {
+        // Longer delays are clamped to the range of the last level
+        if (delta >= (1UL << (3 * WHEEL_BITS))) {
+            timer->expires = wheel.now + (1UL << (3 * WHEEL_BITS)) - 1;
+        }
+        level = 2;
+        slot = (timer->expires >> (2 * WHEEL_BITS)) & WHEEL_MASK;
+    }
+
+    timer->level = level;
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = wheel.slots[level][slot];
+    if (timer->next != NULL) {
+        timer->next->prev = timer;
+    }
+    wheel.slots[level][slot] = timer;
+}
+
+/**
+ * @brief Removes a timer from the list of its slot.
+ */
+static void wheel_unlink(Timer *timer) {
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel.slots[timer->level][timer->slot] = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+/**
+ * @brief Moves the timers of a slot of an upper level to the lower levels.
+ */
+static void wheel_cascade(int level, int slot) {
+    Timer *timer = wheel.slots[level][slot];
+    wheel.slots[level][slot] = NULL;
+
+    while (timer != NULL) {
+        Timer *next = timer->next;
+        wheel_insert(timer);
+        timer = next;
+    }
+}
+
+/**
+ * @brief Advances the wheel by one tick and runs the expired timers.
+ */
+static void wheel_tick() {
+    wheel.now++;
+
+    if ((wheel.now & WHEEL_MASK) == 0) {
+        if (((wheel.now >> WHEEL_BITS) & WHEEL_MASK) == 0) {
+            wheel_cascade(2, (wheel.now >> (2 * WHEEL_BITS)) & WHEEL_MASK);
+        }
+        wheel_cascade(1, (wheel.now >> WHEEL_BITS) & WHEEL_MASK);
+    }
+
+    // Detach the slot first: callbacks may add timers again
+    Timer *timer = wheel.slots[0][wheel.now & WHEEL_MASK];
+    wheel.slots[0][wheel.now & WHEEL_MASK] = NULL;
+
+    while (timer != NULL) {
+        Timer *next = timer->next;
+        timer->prev = NULL;
+        timer->next = NULL;
+        timer->pending = 0;
+        wheel.count--;
+        timer->callback(timer);
+        timer = next;
+    }
+}
+
+/**
+ * @brief Returns the timerfd of the wheel, to be watched with select() or poll().
+ *
+ * @return The file descriptor, or -1 on error.
+ */
+int timer_wheel_fd() {
+    if (wheel.fd == -1) {
+        wheel.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (wheel.fd == -1) {
+            perror("timerfd_create error");
+        }
+    }
+    return wheel.fd;
+}
+
+/**
+ * @brief Schedules a timer.
+ *
+ * @param timer The timer, with its callback set.
+ * @param delay_ms The delay before the callback is called.
+ */
+void timer_add(Timer *timer, long delay_ms) {
+    if (timer_wheel_fd() == -1) return;
+
+    long ticks = (delay_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    if (ticks < 1) ticks = 1;
+
+    if (timer->pending) {
+        timer_cancel(timer);
+    }
+    timer->expires = wheel.now + ticks;
+    timer->pending = 1;
+    wheel_insert(timer);
+
+    if (wheel.count++ == 0) {
+        wheel_arm(1);
+    }
+}
+
+/**
+ * @brief Removes a timer from the wheel before it expires.
+ *
+ * @param timer The timer to cancel (nothing happens if it is not pending).
+ */
+void timer_cancel(Timer *timer) {
+    if (!timer->pending) return;
+
+    wheel_unlink(timer);
+    timer->pending = 0;
+    if (--wheel.count == 0) {
+        wheel_arm(0);
+    }
+}
+
+/**
+ * @brief Runs the ticks elapsed since the last call. To be called when the timerfd is readable.
+ */
+void timer_wheel_process() {
+    uint64_t expirations;
+
+    if (wheel.fd == -1 || read(wheel.fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+
+    for (uint64_t i = 0; i < expirations && wheel.count > 0; i++) {
+        wheel_tick();
+    }
+
+    if (wheel.count == 0) {
+        wheel_arm(0);
+    }
+}
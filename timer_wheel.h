@@ -0,0 +1,29 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#define WHEEL_TICK_MS 100   // Resolution of the timers
+#define WHEEL_LEVELS 3      // 64 ticks, 64^2 ticks and 64^3 ticks (about 7 hours)
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MAX_MS (((1L << (WHEEL_LEVELS * WHEEL_BITS)) - 1) * WHEEL_TICK_MS)  // Longest delay of a timer
+
+typedef struct Timer Timer;
+
+// A timer of the wheel. The owner allocates it and keeps it alive while it is pending.
+struct Timer {
+    unsigned long expires;           // Tick at which the timer fires
+    void (*callback)(Timer *timer);  // Called once when the timer expires
+    void *data;                      // Free for the owner of the timer
+    int pending;                     // 1 while the timer is in the wheel
+    int level;                       // Position in the wheel, used to cancel the timer
+    int slot;
+    Timer *prev;
+    Timer *next;
+};
+
+int timer_wheel_fd();
+void timer_add(Timer *timer, long delay_ms);
+void timer_cancel(Timer *timer);
+void timer_wheel_process();
+
+#endif
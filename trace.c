@@ -0,0 +1,174 @@
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+// Set when TRACE_FILE is given
+int trace_enabled = 0;
+
+static int trace_fd = -1;
+static const char *trace_role = "";
+static unsigned long long id_counter = 0;
+
+// Events recorded by a thread, written with a single append when the buffer is
+// full or flushed. Each thread has its own buffer, so recording never takes a
+// lock, and appends from several processes never interleave inside an event.
+typedef struct {
+    char data[TRACE_BUFFER_SIZE];
+    size_t length;
+    pid_t owner;         // Process the events belong to (a forked child starts empty)
+} TraceBuffer;
+
+static __thread TraceBuffer *buffer = NULL;
+static __thread int buffer_failed = 0;  // No memory for the buffer: the thread records nothing
+static __thread unsigned long long current_id = 0;  // Trace of the command being handled
+
+/**
+ * @brief Returns the buffer of the calling thread, emptied if it was inherited through fork().
+ *
+ * @return The buffer, or NULL if it could not be allocated (tracing is then off for the thread).
+ */
+static TraceBuffer *trace_buffer() {
+    if (buffer == NULL) {
+        if (buffer_failed) return NULL;
+        buffer = malloc(sizeof(TraceBuffer));
+        if (buffer == NULL) {
+            perror("malloc error");
+            buffer_failed = 1;
+            return NULL;
+        }
+        buffer->length = 0;
+        buffer->owner = getpid();
+    }
+    if (buffer->owner != getpid()) {
+        buffer->length = 0;  // The parent writes these events itself
+        buffer->owner = getpid();
+    }
+    return buffer;
+}
+
+/**
+ * @brief Appends an event to the buffer of the calling thread.
+ */
+static void trace_append(const char *event, size_t length) {
+    TraceBuffer *events = trace_buffer();
+    if (events == NULL) return;
+    if (events->length + length > TRACE_BUFFER_SIZE) {
+        trace_flush();
+    }
+    if (length <= TRACE_BUFFER_SIZE) {
+        memcpy(events->data + events->length, event, length);
+        events->length += length;
+    }
+}
+
+/**
+ * @brief Enables tracing if TRACE_FILE is set.
+ *
+ * Every process (server and clients) appends its events to the same file, in the
+ * JSON array format of Chrome tracing (chrome://tracing, Perfetto), which does
+ * not need the closing bracket. The process creating the file writes the opening one.
+ *
+ * @param role Name of the process in the trace (shell, server, client...).
+ */
+void trace_init(const char *role) {
+    const char *path = getenv("TRACE_FILE");
+    if (path == NULL || path[0] == '\0') {
+        return;
+    }
+
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+    if (trace_fd != -1) {
+        if (write(trace_fd, "[\n", 2) != 2) {
+            perror("write error");
+        }
+    } else if (errno == EEXIST) {
+        trace_fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+    if (trace_fd == -1) {
+        perror("open error");
+        return;
+    }
+
+    trace_role = role;
+    trace_enabled = 1;
+    atexit(trace_flush);
+
+    // Name the process in the viewer
+    char event[256];
+    int length = snprintf(event, sizeof(event),
+                          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s %d\"}},\n",
+                          getpid(), role, getpid());
+    trace_append(event, length);
+}
+
+/**
+ * @brief Returns the wall-clock time in microseconds, comparable between processes.
+ */
+long long trace_now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/**
+ * @brief Creates a trace ID, unique across the processes of the host.
+ */
+unsigned long long trace_new_id() {
+    return ((unsigned long long)getpid() << 40) ^ ((unsigned long long)trace_now_us() << 8) ^ ++id_counter;
+}
+
+/**
+ * @brief Sets the trace the next spans of the thread belong to (0 for none).
+ */
+void trace_set_id(unsigned long long id) {
+    current_id = id;
+}
+
+/**
+ * @brief Returns the trace the spans of the thread belong to.
+ */
+unsigned long long trace_get_id() {
+    return current_id;
+}
+
+/**
+ * @brief Records a span of the current trace. Use TRACE_START() and TRACE_END() instead.
+ */
+void trace_span(const char *name, long long start_us, long long end_us) {
+    if (!trace_enabled) return;
+
+    char event[512];
+    int length = snprintf(event, sizeof(event),
+                          "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+                          "\"pid\":%d,\"tid\":%ld,\"args\":{\"trace\":\"%016llx\"}},\n",
+                          name, trace_role, start_us, end_us - start_us,
+                          getpid(), (long)syscall(SYS_gettid), current_id);
+    if (length > 0 && (size_t)length < sizeof(event)) {
+        trace_append(event, length);
+    }
+}
+
+/**
+ * @brief Writes the events recorded by the calling thread to the trace file.
+ */
+void trace_flush() {
+    if (!trace_enabled || buffer == NULL || buffer->owner != getpid()) {
+        return;
+    }
+
+    const char *data = buffer->data;
+    size_t length = buffer->length;
+    while (length > 0) {
+        ssize_t written = write(trace_fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            perror("write error");
+            break;
+        }
+        data += written;
+        length -= written;
+    }
+    buffer->length = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_BUFFER_SIZE (64 * 1024)  // Events kept by each thread before they are written
+
+// Set by trace_init() when TRACE_FILE is given; everything else is skipped otherwise
+extern int trace_enabled;
+
+// Spans are measured with these two macros, which cost a single test when tracing is disabled:
+//   long long start = TRACE_START();
+//   ...
+//   TRACE_END("spawn", start);
+#define TRACE_START() (trace_enabled ? trace_now_us() : 0)
+#define TRACE_END(name, start) do { if (start) trace_span(name, start, trace_now_us()); } while (0)
+
+void trace_init(const char *role);
+long long trace_now_us();
+unsigned long long trace_new_id();
+void trace_set_id(unsigned long long id);
+unsigned long long trace_get_id();
+void trace_span(const char *name, long long start_us, long long end_us);
+void trace_flush();
+
+#endif
@@ -0,0 +1,748 @@
+#include "transfer.h"
+#include "session.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#endif
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// File received from the server or sent to it, on the client
+typedef struct {
+    int fd;                    // -1 when there is none
+    char path[TRANSFER_PATH_SIZE];
+    char part[TRANSFER_PATH_SIZE + 32];
+    size_t size;
+    size_t offset;             // Next byte received or sent
+    size_t resumed;
+    size_t frame_left;         // Bytes of the current data frame still in the socket
+    unsigned long long checksum;
+    int error;                 // errno of the first write that failed (the rest of the data is dropped)
+} ClientFile;
+
+static ClientFile incoming = {.fd = -1};
+static ClientFile outgoing = {.fd = -1};
+static int splice_pipe[2] = {-1, -1};  // Moves data from the socket to the file without a copy in user space
+
+/**
+ * @brief Returns the current time in milliseconds (monotonic clock).
+ */
+static double now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+/**
+ * @brief Computes the checksum of a block of bytes (64-bit FNV-1a).
+ */
+static unsigned long long checksum_of(const unsigned char *data, size_t size) {
+    unsigned long long checksum = FNV_OFFSET;
+    for (size_t i = 0; i < size; i++) {
+        checksum = (checksum ^ data[i]) * FNV_PRIME;
+    }
+    return checksum;
+}
+
+/**
+ * @brief Computes the checksum of a file through a mapping.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int file_checksum(int fd, size_t size, unsigned long long *checksum) {
+    *checksum = FNV_OFFSET;
+    if (size == 0) return 0;
+
+    unsigned char *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap error");
+        return -1;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    *checksum = checksum_of(data, size);
+    munmap(data, size);
+    return 0;
+}
+
+/**
+ * @brief Opens the partial file a transfer is received into.
+ *
+ * Its name holds the checksum of the file, so an interrupted transfer is only
+ * resumed with the same content.
+ *
+ * @param part Receives the name of the partial file.
+ * @param offset Receives the number of bytes already received.
+ * @return The file descriptor, or -1 on error.
+ */
+static int open_part(const char *path, unsigned long long checksum, size_t size,
+                     char *part, size_t part_size, size_t *offset) {
+    snprintf(part, part_size, "%s.%016llx.part", path, checksum);
+    int fd = open(part, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat info;
+    *offset = fstat(fd, &info) == 0 ? info.st_size : 0;
+    if (*offset > size) {
+        *offset = 0;
+        if (ftruncate(fd, 0) == -1) {
+            perror("ftruncate error");
+        }
+    }
+    return fd;
+}
+
+/**
+ * @brief Checks a received file against its checksum and gives it its final name.
+ *
+ * A file that does not match is deleted, so the next transfer starts over.
+ *
+ * @return 0 if the file is complete, -1 otherwise.
+ */
+static int complete_part(int fd, const char *part, const char *path, size_t size, unsigned long long expected) {
+    unsigned long long checksum;
+    int result = file_checksum(fd, size, &checksum);
+    close(fd);
+
+    if (result == 0 && checksum != expected) {
+        unlink(part);
+        return -1;
+    }
+    if (result == 0 && rename(part, path) == -1) {
+        perror("rename error");
+        return -1;
+    }
+    return result;
+}
+
+/**
+ * @brief Writes bytes at a given offset of a file.
+ *
+ * @return 0 on success, -1 on error (errno is set).
+ */
+static int write_at(int fd, const char *data, size_t length, size_t offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        offset += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/**
+ * @brief Gives the size of the next data frame of a client, so it fits in its memory cap.
+ *
+ * A pushed frame the socket does not take at once is queued in output chunks,
+ * a pulled frame is assembled in a buffer counted in the chunks of the client
+ * next to its input chunk (one more chunk is left for the other frames). Both
+ * are also charged to the arena, so the frame shrinks when the budget is low.
+ *
+ * @param client The client.
+ * @param pull 1 for a frame received from the client, 0 for a frame sent to it.
+ * @return The number of bytes of the file the frame may carry.
+ */
+static size_t transfer_chunk(ClientInfo *client, int pull) {
+    // The chunks the client may still take, within its cap and the budget left in the arena
+    size_t left = client->cap_chunks > client->chunks ? client->cap_chunks - client->chunks : 0;
+    size_t budget_left = client->arena->num_chunks - client->arena->used;
+    if (budget_left < left) left = budget_left;
+
+    size_t room = 0;
+    if (pull && left > 1) {
+        room = (left - 1) * CHUNK_SIZE - FRAME_HEADER_SIZE - 1;
+    } else if (!pull && left > 0) {
+        room = left * OUT_CHUNK_DATA - FRAME_HEADER_SIZE;
+    }
+
+    // At worst a frame that fits in a single chunk
+    size_t least = pull ? CHUNK_SIZE - FRAME_HEADER_SIZE : OUT_CHUNK_DATA - FRAME_HEADER_SIZE;
+    if (room < least) room = least;
+    return room < TRANSFER_CHUNK ? room : TRANSFER_CHUNK;
+}
+
+/**
+ * @brief Releases the transfer of a client (the partial file of a pull stays for a later resume).
+ */
+static void transfer_release(ClientInfo *client) {
+    Transfer *transfer = client->transfer;
+    PushSource *source = transfer->source;
+
+    if (source != NULL && --source->users == 0) {
+        if (source->data != NULL) {
+            munmap(source->data, source->size);
+        }
+        free(source);
+    }
+    if (transfer->fd != -1) {
+        close(transfer->fd);
+    }
+    free(transfer);
+    client->transfer = NULL;
+}
+
+/**
+ * @brief Creates the transfer of a client.
+ */
+static Transfer *transfer_create(ClientInfo *client, int pull, const char *local, const char *remote) {
+    Transfer *transfer = calloc(1, sizeof(Transfer));
+    transfer->pull = pull;
+    transfer->fd = -1;
+    transfer->start_ms = now_ms();
+    snprintf(transfer->local, sizeof(transfer->local), "%s", local);
+    snprintf(transfer->remote, sizeof(transfer->remote), "%s", remote);
+    client->transfer = transfer;
+    return transfer;
+}
+
+/**
+ * @brief Sends a file to clients: "push <local> <remote> -all" or "push <local> <remote> -id <x> [<y> ...]".
+ *
+ * The file is mapped once, and every client is sent its chunks straight from the
+ * mapping as its socket accepts them. A client that already holds the beginning
+ * of the file from an interrupted push only receives the rest.
+ *
+ * @param args The arguments following 'push' on the console.
+ * @param clients The array of connected clients.
+ * @param map_job The -map job, told about the clients lost while sending.
+ */
+void transfer_push(char *args, ClientInfo *clients, MapJob *map_job) {
+    char *saveptr;
+    char *local = strtok_r(args, " \t", &saveptr);
+    char *remote = strtok_r(NULL, " \t", &saveptr);
+    char *target = strtok_r(NULL, "", &saveptr);
+    int slots[MAX_CLIENTS];
+    int num_targets = client_select(clients, MAX_CLIENTS, target, slots);
+
+    if (local == NULL || remote == NULL || num_targets < 0) {
+        printf("Usage: push <local> <remote> -all | push <local> <remote> -id <x> [<y> ...]\n");
+        return;
+    }
+
+    int fd = open(local, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("open error");
+        return;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+        printf("%s is not a regular file\n", local);
+        close(fd);
+        return;
+    }
+
+    PushSource *source = calloc(1, sizeof(PushSource));
+    source->size = info.st_size;
+    if (source->size > 0) {
+        source->data = mmap(NULL, source->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (source->data == MAP_FAILED) {
+            perror("mmap error");
+            close(fd);
+            free(source);
+            return;
+        }
+        madvise(source->data, source->size, MADV_SEQUENTIAL);
+    }
+    source->checksum = checksum_of((unsigned char *)source->data, source->size);
+    close(fd);
+
+    char header[TRANSFER_PATH_SIZE + 64];
+    snprintf(header, sizeof(header), "%zu %016llx %s", source->size, source->checksum, remote);
+
+    for (int k = 0; k < num_targets; k++) {
+        ClientInfo *client = &clients[slots[k]];
+        if (client->transfer != NULL) {
+            printf("Client socket %d is already transferring %s\n", client->socket_fd, client->transfer->remote);
+            continue;
+        }
+        if (client_send_frame(client, FRAME_PUSH, header, strlen(header) + 1) == -1) {
+            client_detach(client);
+            map_handle_disconnect(map_job, clients, slots[k]);
+            continue;
+        }
+
+        Transfer *transfer = transfer_create(client, 0, local, remote);
+        transfer->source = source;
+        transfer->size = source->size;
+        transfer->checksum = source->checksum;
+        source->users++;
+        output_record(&client->output, "$ push", header);
+        printf("Pushing %s to client socket %d as %s (%zu bytes)\n", local, client->socket_fd, remote, source->size);
+    }
+
+    if (source->users == 0) {
+        if (source->data != NULL) {
+            munmap(source->data, source->size);
+        }
+        free(source);
+    }
+}
+
+/**
+ * @brief Fetches a file from clients: "pull <remote> <local> -all" or "pull <remote> <local> -id <x> [<y> ...]".
+ *
+ * With several clients, each file is saved as <local>.<socket>.
+ *
+ * @param args The arguments following 'pull' on the console.
+ * @param clients The array of connected clients.
+ * @param map_job The -map job, told about the clients lost while sending.
+ */
+void transfer_pull(char *args, ClientInfo *clients, MapJob *map_job) {
+    char *saveptr;
+    char *remote = strtok_r(args, " \t", &saveptr);
+    char *local = strtok_r(NULL, " \t", &saveptr);
+    char *target = strtok_r(NULL, "", &saveptr);
+    int slots[MAX_CLIENTS];
+    int num_targets = client_select(clients, MAX_CLIENTS, target, slots);
+
+    if (remote == NULL || local == NULL || num_targets < 0) {
+        printf("Usage: pull <remote> <local> -all | pull <remote> <local> -id <x> [<y> ...]\n");
+        return;
+    }
+
+    for (int k = 0; k < num_targets; k++) {
+        ClientInfo *client = &clients[slots[k]];
+        if (client->transfer != NULL) {
+            printf("Client socket %d is already transferring %s\n", client->socket_fd, client->transfer->remote);
+            continue;
+        }
+
+        char path[TRANSFER_PATH_SIZE];
+        if (num_targets > 1) {
+            snprintf(path, sizeof(path), "%s.%d", local, client->socket_fd);
+        } else {
+            snprintf(path, sizeof(path), "%s", local);
+        }
+
+        int sock = client->socket_fd;
+        if (client_send_frame(client, FRAME_PULL, remote, strlen(remote) + 1) == -1) {
+            client_detach(client);
+            map_handle_disconnect(map_job, clients, slots[k]);
+            continue;
+        }
+        transfer_create(client, 1, path, remote);
+        output_record(&client->output, "$ pull", remote);
+        printf("Pulling %s from client socket %d into %s\n", remote, sock, path);
+    }
+}
+
+/**
+ * @brief Prints the outcome of a pull once the whole file is received.
+ */
+static void finish_pull(ClientInfo *client) {
+    Transfer *transfer = client->transfer;
+    char part[TRANSFER_PATH_SIZE + 32];
+    double elapsed = now_ms() - transfer->start_ms;
+    char message[TRANSFER_PATH_SIZE * 2 + 128];
+
+    snprintf(part, sizeof(part), "%s.%016llx.part", transfer->local, transfer->checksum);
+    int result = complete_part(transfer->fd, part, transfer->local, transfer->size, transfer->checksum);
+    transfer->fd = -1;
+
+    if (result == 0) {
+        snprintf(message, sizeof(message), "Pull complete: %s -> %s (%zu bytes, %zu resumed, checksum %016llx)",
+                 transfer->remote, transfer->local, transfer->size, transfer->resumed, transfer->checksum);
+        printf("\n%s in %.1f ms, %.1f MB/s\n", message, elapsed,
+               elapsed > 0 ? (transfer->size - transfer->resumed) / 1000.0 / elapsed : 0.0);
+    } else {
+        snprintf(message, sizeof(message), "Pull failed: checksum mismatch for %s, pull it again", transfer->remote);
+        printf("\nClient socket %d: %s\n", client->socket_fd, message);
+    }
+    output_record(&client->output, "", message);
+    transfer_release(client);
+}
+
+/**
+ * @brief Handles a frame of a client that belongs to its transfer.
+ *
+ * @return 1 if the frame was handled, 0 if it is not part of a transfer.
+ */
+int transfer_handle_frame(ClientInfo *client, Frame *frame) {
+    Transfer *transfer = client->transfer;
+    char offset_text[32];
+
+    if (transfer == NULL) {
+        return frame->type == FRAME_DATA || frame->type == FRAME_OFFSET || frame->type == FRAME_FILE;
+    }
+
+    if (frame->type == FRAME_OFFSET && !transfer->pull && !transfer->started) {
+        // The client tells how much of the file it has, the data flows from there
+        long long offset = strtoll(frame->payload, NULL, 10);
+        transfer->offset = offset > 0 && (size_t)offset <= transfer->size ? offset : 0;
+        transfer->resumed = transfer->offset;
+        transfer->started = 1;
+        return 1;
+    }
+
+    if (frame->type == FRAME_FILE && transfer->pull && !transfer->started) {
+        // The client describes the file, ask for what is missing from the partial file
+        char part[TRANSFER_PATH_SIZE + 32];
+        unsigned long long checksum = 0;
+        size_t size = 0;
+        sscanf(frame->payload, "%zu %llx", &size, &checksum);
+        transfer->size = size;
+        transfer->checksum = checksum;
+        transfer->fd = open_part(transfer->local, checksum, size, part, sizeof(part), &transfer->offset);
+        if (transfer->fd == -1) {
+            perror("open error");
+            client_send_frame(client, FRAME_OFFSET, "-1", 3);
+            transfer_release(client);
+            return 1;
+        }
+        transfer->resumed = transfer->offset;
+        transfer->started = 1;
+        snprintf(offset_text, sizeof(offset_text), "%zu %zu", transfer->offset, transfer_chunk(client, 1));
+        if (client_send_frame(client, FRAME_OFFSET, offset_text, strlen(offset_text) + 1) == -1) {
+            transfer_release(client);
+        } else if (transfer->offset == transfer->size) {
+            finish_pull(client);
+        }
+        return 1;
+    }
+
+    if (frame->type == FRAME_DATA && transfer->pull && transfer->started) {
+        if (frame->length > transfer->size - transfer->offset) {
+            printf("\nClient socket %d sent more than the size of %s\n", client->socket_fd, transfer->remote);
+            transfer_release(client);
+            return 1;
+        }
+        if (write_at(transfer->fd, frame->payload, frame->length, transfer->offset) == -1) {
+            perror("write error");
+            printf("Pull of %s from client socket %d stopped at %zu bytes\n", transfer->remote, client->socket_fd, transfer->offset);
+            transfer_release(client);
+            return 1;
+        }
+        transfer->offset += frame->length;
+        if (transfer->offset == transfer->size) {
+            finish_pull(client);
+        }
+        return 1;
+    }
+
+    if (frame->type == FRAME_RESPONSE && strncmp(frame->payload, transfer->pull ? "Pull " : "Push ", 5) == 0) {
+        // End of a push (checked by the client), or a pull the client could not serve
+        double elapsed = now_ms() - transfer->start_ms;
+        output_record(&client->output, "", frame->payload);
+        printf("\nResponse from client socket %d: %s", client->socket_fd, frame->payload);
+        if (!transfer->pull && strncmp(frame->payload, "Push complete", 13) == 0) {
+            printf(" in %.1f ms, %.1f MB/s", elapsed,
+                   elapsed > 0 ? (transfer->size - transfer->resumed) / 1000.0 / elapsed : 0.0);
+        }
+        printf("\n");
+        transfer_release(client);
+        return 1;
+    }
+
+    return frame->type == FRAME_DATA || frame->type == FRAME_OFFSET || frame->type == FRAME_FILE;
+}
+
+/**
+ * @brief Tells if a client has pushed data waiting for its socket to be writable.
+ */
+int transfer_wants_write(ClientInfo *client) {
+    Transfer *transfer = client->transfer;
+    return transfer != NULL && !transfer->pull && transfer->started && transfer->offset < transfer->size;
+}
+
+/**
+ * @brief Sends the next chunks of a push while the socket of the client accepts them.
+ *
+ * A chunk is only sent once the previous ones have left, so at most one chunk
+ * per client is ever copied out of the mapping into the arena.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int transfer_send_pending(ClientInfo *client) {
+    while (transfer_wants_write(client) && client->out_head == NULL) {
+        Transfer *transfer = client->transfer;
+        size_t length = transfer->size - transfer->offset;
+        size_t chunk = transfer_chunk(client, 0);
+        if (length > chunk) length = chunk;
+
+        if (client_send_frame(client, FRAME_DATA, transfer->source->data + transfer->offset, length) == -1) {
+            return -1;
+        }
+        transfer->offset += length;
+    }
+    return 0;
+}
+
+/**
+ * @brief Stops the transfer of a disconnected client.
+ */
+void transfer_abort(ClientInfo *client) {
+    Transfer *transfer = client->transfer;
+    printf("\n%s of %s interrupted after %zu/%zu bytes (run it again to resume)\n",
+           transfer->pull ? "Pull" : "Push", transfer->remote, transfer->offset, transfer->size);
+    transfer_release(client);
+}
+
+/**
+ * @brief Sends the result of a push to the server.
+ */
+static int client_file_done(int sockfd, ClientFile *file, const char *format, ...) __attribute__((format(printf, 3, 4)));
+static int client_file_done(int sockfd, ClientFile *file, const char *format, ...) {
+    char response[TRANSFER_PATH_SIZE * 2];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(response, sizeof(response), format, args);
+    va_end(args);
+    printf("\n%s\n", response);
+
+    if (file->fd != -1) {
+        close(file->fd);
+        file->fd = -1;
+    }
+    return session_send_response(sockfd, response, strlen(response) + 1);
+}
+
+/**
+ * @brief Checks a pushed file once all its bytes are received and tells the server.
+ */
+static int finish_push(int sockfd) {
+    if (incoming.error != 0) {
+        return client_file_done(sockfd, &incoming, "Push failed: cannot write %s: %s", incoming.part, strerror(incoming.error));
+    }
+
+    int result = complete_part(incoming.fd, incoming.part, incoming.path, incoming.size, incoming.checksum);
+    incoming.fd = -1;
+    if (result == -1) {
+        return client_file_done(sockfd, &incoming, "Push failed: checksum mismatch for %s, push it again", incoming.path);
+    }
+    return client_file_done(sockfd, &incoming, "Push complete: %s (%zu bytes, %zu resumed, checksum %016llx)",
+                            incoming.path, incoming.size, incoming.resumed, incoming.checksum);
+}
+
+/**
+ * @brief Stores bytes of the pushed file (dropped after a write error, reported at the end).
+ */
+static void store_incoming(const char *data, size_t length) {
+    if (incoming.error == 0 && write_at(incoming.fd, data, length, incoming.offset) == -1) {
+        incoming.error = errno;
+    }
+    incoming.offset += length;
+}
+
+/**
+ * @brief Sends the file asked by a pull, from the offset the server already has.
+ *
+ * Every chunk is a frame header followed by its bytes, which sendfile() moves
+ * from the page cache to the socket without going through user space. The
+ * server gives the size of the chunks, so each frame fits in its memory cap.
+ */
+static int send_outgoing(int sockfd, long long offset, size_t chunk) {
+    if (offset < 0 || (size_t)offset > outgoing.size) {
+        close(outgoing.fd);
+        outgoing.fd = -1;
+        return 0;
+    }
+
+    if (chunk == 0 || chunk > TRANSFER_CHUNK) {
+        chunk = TRANSFER_CHUNK;
+    }
+
+    off_t position = offset;
+    while ((size_t)position < outgoing.size) {
+        size_t length = outgoing.size - position;
+        if (length > chunk) length = chunk;
+
+        char header[FRAME_HEADER_SIZE];
+        frame_header(header, FRAME_DATA, length);
+        if (send(sockfd, header, FRAME_HEADER_SIZE, MSG_MORE | MSG_NOSIGNAL) != FRAME_HEADER_SIZE) {
+            perror("send error");
+            return -1;
+        }
+        while (length > 0) {
+            ssize_t sent = sendfile(sockfd, outgoing.fd, &position, length);
+            if (sent <= 0) {
+                if (sent < 0 && errno == EINTR) continue;
+                // The file shrank or the socket failed: the stream cannot be resynchronized
+                perror("sendfile error");
+                return -1;
+            }
+            length -= sent;
+        }
+    }
+
+    printf("\nSent %s to the server (%zu bytes, %lld already there)\n", outgoing.path, outgoing.size, offset);
+    close(outgoing.fd);
+    outgoing.fd = -1;
+    return 0;
+}
+
+/**
+ * @brief Handles a frame of the server that belongs to a transfer, on the client.
+ *
+ * @return 1 if the frame was handled, 0 if it is not part of a transfer, -1 if
+ *         the connection failed.
+ */
+int transfer_client_frame(int sockfd, Frame *frame) {
+    if (frame->type == FRAME_PUSH) {
+        // The server is about to send a file: answer with what we already have
+        int path_start = 0;
+        if (incoming.fd != -1) close(incoming.fd);
+        memset(&incoming, 0, sizeof(incoming));
+        incoming.fd = -1;
+        sscanf(frame->payload, "%zu %llx %n", &incoming.size, &incoming.checksum, &path_start);
+        snprintf(incoming.path, sizeof(incoming.path), "%s", frame->payload + path_start);
+
+        incoming.fd = open_part(incoming.path, incoming.checksum, incoming.size,
+                                incoming.part, sizeof(incoming.part), &incoming.offset);
+        if (incoming.fd == -1) {
+            return client_file_done(sockfd, &incoming, "Push failed: cannot open %s: %s", incoming.part, strerror(errno)) == -1 ? -1 : 1;
+        }
+        incoming.resumed = incoming.offset;
+        printf("\nReceiving %s from the server (%zu bytes, %zu already there)\n", incoming.path, incoming.size, incoming.offset);
+
+        char offset_text[32];
+        snprintf(offset_text, sizeof(offset_text), "%zu", incoming.offset);
+        if (send_frame(sockfd, FRAME_OFFSET, offset_text, strlen(offset_text) + 1) == -1) return -1;
+        if (incoming.offset == incoming.size) {
+            return finish_push(sockfd) == -1 ? -1 : 1;
+        }
+        return 1;
+    }
+
+    if (frame->type == FRAME_DATA) {
+        if (incoming.fd == -1) return 1;
+        size_t length = frame->length;
+        if (length > incoming.size - incoming.offset) length = incoming.size - incoming.offset;
+        store_incoming(frame->payload, length);
+        if (incoming.offset == incoming.size) {
+            return finish_push(sockfd) == -1 ? -1 : 1;
+        }
+        return 1;
+    }
+
+    if (frame->type == FRAME_PULL) {
+        // The server wants a file: describe it, the data follows once it gives its offset
+        if (outgoing.fd != -1) close(outgoing.fd);
+        memset(&outgoing, 0, sizeof(outgoing));
+        snprintf(outgoing.path, sizeof(outgoing.path), "%s", frame->payload);
+
+        struct stat info;
+        outgoing.fd = open(outgoing.path, O_RDONLY | O_CLOEXEC);
+        if (outgoing.fd == -1 || fstat(outgoing.fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+            int error = outgoing.fd == -1 ? errno : EINVAL;
+            return client_file_done(sockfd, &outgoing, "Pull failed: cannot read %s: %s", outgoing.path, strerror(error)) == -1 ? -1 : 1;
+        }
+        outgoing.size = info.st_size;
+        file_checksum(outgoing.fd, outgoing.size, &outgoing.checksum);
+
+        char description[64];
+        snprintf(description, sizeof(description), "%zu %016llx", outgoing.size, outgoing.checksum);
+        return send_frame(sockfd, FRAME_FILE, description, strlen(description) + 1) == -1 ? -1 : 1;
+    }
+
+    if (frame->type == FRAME_OFFSET) {
+        if (outgoing.fd == -1) return 1;
+        long long offset = 0;
+        size_t chunk = 0;
+        sscanf(frame->payload, "%lld %zu", &offset, &chunk);
+        return send_outgoing(sockfd, offset, chunk) == -1 ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Tells if a file pushed by the server is being received.
+ */
+int transfer_client_receiving() {
+    return incoming.fd != -1;
+}
+
+/**
+ * @brief Forgets the files moving when the connection to the server is lost.
+ *
+ * Partial files stay on disk, so the next push of the same file resumes.
+ */
+void transfer_client_reset() {
+    ClientFile *files[] = {&incoming, &outgoing};
+    for (int i = 0; i < 2; i++) {
+        if (files[i]->fd != -1) {
+            close(files[i]->fd);
+            files[i]->fd = -1;
+        }
+    }
+}
+
+/**
+ * @brief Reads from the server, like frame_read(), moving pushed data straight to its file.
+ *
+ * Once the header of a data frame is in the reader, the bytes it already holds
+ * are written, and the rest of the frame is spliced from the socket to the
+ * file through a pipe, without being copied to user space.
+ *
+ * @return The number of bytes read, 0 if the server closed the connection, -1 on error.
+ */
+int transfer_client_read(int sockfd, FrameReader *reader) {
+    if (incoming.fd != -1 && incoming.frame_left == 0) {
+        Frame frame;
+        frame_reader_compact(reader);
+        if (reader->length >= FRAME_HEADER_SIZE && reader->data[4] == FRAME_DATA &&
+            frame_parse(reader->data, reader->length, &frame) == 0 &&
+            frame.length <= incoming.size - incoming.offset) {
+            store_incoming(frame.payload, reader->length - FRAME_HEADER_SIZE);
+            incoming.frame_left = FRAME_HEADER_SIZE + frame.length - reader->length;
+            reader->length = 0;
+        }
+    }
+    if (incoming.fd == -1 || incoming.frame_left == 0) {
+        return frame_read(sockfd, reader);
+    }
+
+    ssize_t moved;
+    if (incoming.error != 0) {
+        // The file cannot be written: drop the data, the failure is reported at the end
+        char discard[4096];
+        size_t length = incoming.frame_left < sizeof(discard) ? incoming.frame_left : sizeof(discard);
+        moved = read(sockfd, discard, length);
+    } else {
+        if (splice_pipe[0] == -1 && pipe(splice_pipe) == -1) {
+            perror("pipe error");
+            return -1;
+        }
+        moved = syscall(SYS_splice, sockfd, NULL, splice_pipe[1], NULL, incoming.frame_left, SPLICE_F_MOVE);
+        long long position = incoming.offset;
+        for (ssize_t left = moved; left > 0 && incoming.error == 0; ) {
+            ssize_t written = syscall(SYS_splice, splice_pipe[0], NULL, incoming.fd, &position, left, SPLICE_F_MOVE);
+            if (written <= 0) {
+                incoming.error = written < 0 ? errno : EIO;
+                // Empty the pipe so it can be reused
+                char discard[4096];
+                while (left > 0 && (written = read(splice_pipe[0], discard, left < 4096 ? left : 4096)) > 0) {
+                    left -= written;
+                }
+                break;
+            }
+            left -= written;
+        }
+    }
+    if (moved <= 0) {
+        if (moved < 0) perror("splice error");
+        return moved;
+    }
+
+    incoming.offset += moved;
+    incoming.frame_left -= moved;
+    if (incoming.offset == incoming.size && finish_push(sockfd) == -1) {
+        return -1;
+    }
+    return moved;
+}
@@ -0,0 +1,47 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "client_pool.h"
+#include "map.h"
+
+#define TRANSFER_CHUNK (32 * 1024)  // Largest number of bytes of a file per data frame, less when the memory cap of the client is small
+#define TRANSFER_PATH_SIZE 512
+
+// A file pushed by the server, mapped once and shared by every client it is sent to
+typedef struct {
+    char *data;                // NULL for an empty file
+    size_t size;
+    unsigned long long checksum;
+    int users;                 // Transfers still sending it
+} PushSource;
+
+// A file moving between the server and one client ('push' or 'pull' on the console)
+typedef struct Transfer {
+    int pull;                  // 0: server -> client, 1: client -> server
+    char local[TRANSFER_PATH_SIZE];
+    char remote[TRANSFER_PATH_SIZE];
+    PushSource *source;        // Push: the file sent
+    int fd;                    // Pull: the partial file written (-1 before the client describes the file)
+    size_t size;
+    size_t offset;             // Next byte sent (push) or expected (pull)
+    size_t resumed;            // Bytes the receiver already had from an interrupted transfer
+    unsigned long long checksum;
+    int started;               // 1 once the data may flow
+    double start_ms;
+} Transfer;
+
+// Server side
+void transfer_push(char *args, ClientInfo *clients, MapJob *map_job);
+void transfer_pull(char *args, ClientInfo *clients, MapJob *map_job);
+int transfer_handle_frame(ClientInfo *client, Frame *frame);
+int transfer_wants_write(ClientInfo *client);
+int transfer_send_pending(ClientInfo *client);
+void transfer_abort(ClientInfo *client);
+
+// Client side
+int transfer_client_frame(int sockfd, Frame *frame);
+int transfer_client_read(int sockfd, FrameReader *reader);
+int transfer_client_receiving();
+void transfer_client_reset();
+
+#endif
@@ -0,0 +1,488 @@
+#include "variables.h"
+
+// Exit status of the last command, available as $?
+int last_status = 0;
+
+// Hash table of the shell variables
+static Variable **buckets = NULL;
+static size_t num_buckets = 0;
+static size_t num_variables = 0;
+
+// Environment given to the commands, rebuilt only when an exported variable changes
+static char **env_cache = NULL;
+static int env_dirty = 1;
+
+/**
+ * @brief Hashes a variable name (FNV-1a).
+ */
+static size_t hash_name(const char *name, size_t length) {
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Doubles the number of buckets and moves the variables to their new bucket.
+ */
+static void variables_grow() {
+    size_t new_size = num_buckets * 2;
+    Variable **new_buckets = calloc(new_size, sizeof(Variable *));
+
+    for (size_t i = 0; i < num_buckets; i++) {
+        Variable *variable = buckets[i];
+        while (variable != NULL) {
+            Variable *next = variable->next;
+            size_t index = hash_name(variable->name, strlen(variable->name)) % new_size;
+            variable->next = new_buckets[index];
+            new_buckets[index] = variable;
+            variable = next;
+        }
+    }
+
+    free(buckets);
+    buckets = new_buckets;
+    num_buckets = new_size;
+}
+
+/**
+ * @brief Finds a variable from a name which is not necessarily null-terminated.
+ */
+static Variable *variable_find(const char *name, size_t length) {
+    if (buckets == NULL) {
+        // First use: import the environment of the process
+        num_buckets = VARIABLES_BUCKETS;
+        buckets = calloc(num_buckets, sizeof(Variable *));
+        for (char **entry = environ; *entry != NULL; entry++) {
+            char *equal = strchr(*entry, '=');
+            if (equal == NULL) continue;
+            char name_copy[MAX_LINE];
+            snprintf(name_copy, sizeof(name_copy), "%.*s", (int)(equal - *entry), *entry);
+            variable_set(name_copy, equal + 1, 1);
+        }
+    }
+
+    Variable *variable = buckets[hash_name(name, length) % num_buckets];
+    while (variable != NULL) {
+        if (strncmp(variable->name, name, length) == 0 && variable->name[length] == '\0') {
+            return variable;
+        }
+        variable = variable->next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Gets the value of a variable.
+ *
+ * @return The value, or NULL if the variable is not set.
+ */
+char *variable_get(const char *name) {
+    Variable *variable = variable_find(name, strlen(name));
+    return variable != NULL ? variable->value : NULL;
+}
+
+/**
+ * @brief Sets a variable, creating it if needed.
+ *
+ * @param name The name of the variable.
+ * @param value The new value.
+ * @param exported 1 to export the variable (an exported variable stays exported).
+ */
+void variable_set(const char *name, const char *value, int exported) {
+    Variable *variable = variable_find(name, strlen(name));
+
+    if (variable == NULL) {
+        if (num_variables >= num_buckets * 2) {
+            variables_grow();
+        }
+        variable = malloc(sizeof(Variable));
+        variable->name = strdup(name);
+        variable->value = NULL;
+        variable->exported = 0;
+        size_t index = hash_name(name, strlen(name)) % num_buckets;
+        variable->next = buckets[index];
+        buckets[index] = variable;
+        num_variables++;
+    }
+
+    free(variable->value);
+    variable->value = strdup(value);
+    if (exported) {
+        variable->exported = 1;
+    }
+    if (variable->exported) {
+        env_dirty = 1;
+    }
+}
+
+/**
+ * @brief Marks a variable as exported (creates it empty if it does not exist).
+ */
+void variable_export(const char *name) {
+    Variable *variable = variable_find(name, strlen(name));
+    if (variable == NULL) {
+        variable_set(name, "", 1);
+    } else if (!variable->exported) {
+        variable->exported = 1;
+        env_dirty = 1;
+    }
+}
+
+/**
+ * @brief Removes a variable.
+ */
+void variable_unset(const char *name) {
+    if (variable_find(name, strlen(name)) == NULL) return;
+
+    Variable **link = &buckets[hash_name(name, strlen(name)) % num_buckets];
+    while (*link != NULL) {
+        Variable *variable = *link;
+        if (strcmp(variable->name, name) == 0) {
+            *link = variable->next;
+            if (variable->exported) {
+                env_dirty = 1;
+            }
+            free(variable->name);
+            free(variable->value);
+            free(variable);
+            num_variables--;
+            return;
+        }
+        link = &variable->next;
+    }
+}
+
+/**
+ * @brief Returns the environment of the commands ("NAME=value" for each exported variable).
+ *
+ * The array is cached and only rebuilt after an exported variable changed, so
+ * spawning a command does not cost a rebuild. Children get it through fork()
+ * without copying it.
+ *
+ * @return A NULL-terminated array, valid until the next change of an exported variable.
+ */
+char **variables_environ() {
+    variable_find("", 0);  // Makes sure the environment was imported
+    if (!env_dirty) {
+        return env_cache;
+    }
+
+    if (env_cache != NULL) {
+        for (char **entry = env_cache; *entry != NULL; entry++) {
+            free(*entry);
+        }
+        free(env_cache);
+    }
+
+    env_cache = malloc((num_variables + 1) * sizeof(char *));
+    size_t count = 0;
+    for (size_t i = 0; i < num_buckets; i++) {
+        for (Variable *variable = buckets[i]; variable != NULL; variable = variable->next) {
+            if (!variable->exported) continue;
+            size_t length = strlen(variable->name) + strlen(variable->value) + 2;
+            env_cache[count] = malloc(length);
+            snprintf(env_cache[count], length, "%s=%s", variable->name, variable->value);
+            count++;
+        }
+    }
+    env_cache[count] = NULL;
+    env_dirty = 0;
+    return env_cache;
+}
+
+/**
+ * @brief Tells if a word is an assignment "NAME=value".
+ */
+int is_assignment(const char *word) {
+    if (!(word[0] == '_' || (word[0] >= 'a' && word[0] <= 'z') || (word[0] >= 'A' && word[0] <= 'Z'))) {
+        return 0;
+    }
+    for (const char *p = word + 1; *p != '\0'; p++) {
+        if (*p == '=') return 1;
+        if (!(*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9'))) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Cuts the next word of a command, keeping quoted spaces inside the word.
+ *
+ * The quotes are left in the word, they are removed by expand_word().
+ *
+ * @param cursor Position in the command, advanced past the word.
+ * @return The word, or NULL at the end of the command.
+ */
+char *next_word(char **cursor) {
+    char *position = *cursor;
+    char quote = 0;
+
+    while (*position == ' ' || *position == '\t' || *position == '\n') position++;
+    if (*position == '\0') {
+        *cursor = position;
+        return NULL;
+    }
+
+    char *word = position;
+    while (*position != '\0') {
+        if (quote != 0) {
+            if (*position == quote) quote = 0;
+        }
+        else if (*position == '\'' || *position == '"') {
+            quote = *position;
+        }
+        else if (*position == ' ' || *position == '\t' || *position == '\n') {
+            break;
+        }
+        position++;
+    }
+
+    if (*position != '\0') {
+        *position++ = '\0';
+    }
+    *cursor = position;
+    return word;
+}
+
+/**
+ * @brief Finds the first occurrence of a separator outside quotes.
+ *
+ * @param text The text searched.
+ * @param separator The separator ("|", "&&").
+ * @return A pointer to the separator, or NULL if there is none.
+ */
+char *find_unquoted(char *text, const char *separator) {
+    size_t length = strlen(separator);
+    char quote = 0;
+
+    for (char *position = text; *position != '\0'; position++) {
+        if (quote != 0) {
+            if (*position == quote) quote = 0;
+        }
+        else if (*position == '\'' || *position == '"') {
+            quote = *position;
+        }
+        else if (strncmp(position, separator, length) == 0) {
+            return position;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Cuts the next part of a command line at a separator outside quotes.
+ *
+ * Like strtok_r(), empty parts are skipped, but a quoted separator stays in
+ * its part and a single '&' is not taken for "&&".
+ *
+ * @param cursor Position in the command line, advanced past the separator (NULL at the end).
+ * @param separator The separator ("|", "&&").
+ * @return The part, or NULL at the end of the command line.
+ */
+char *next_part(char **cursor, const char *separator) {
+    while (*cursor != NULL) {
+        char *part = *cursor;
+        char *end = find_unquoted(part, separator);
+        if (end != NULL) {
+            *end = '\0';
+            *cursor = end + strlen(separator);
+        } else {
+            *cursor = NULL;
+        }
+        if (*part != '\0') return part;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Copies a string into the expansion pool.
+ *
+ * @return 0 on success, -1 if the pool is full.
+ */
+static int pool_append(char **pool, char *pool_end, const char *text, size_t length) {
+    if (*pool + length >= pool_end) return -1;
+    memcpy(*pool, text, length);
+    *pool += length;
+    return 0;
+}
+
+/**
+ * @brief Resolves a variable reference ($NAME, ${NAME} or $?).
+ *
+ * @param reference Position of the '$'.
+ * @param status Buffer used for the value of $?.
+ * @param last Set to the last character of the reference.
+ * @return The value (empty for an undefined variable), or NULL if this '$' is not a reference.
+ */
+static const char *reference_value(const char *reference, char status[16], const char **last) {
+    const char *name = reference + 1;
+    size_t length = 0;
+    int braces = (*name == '{');
+
+    if (braces) name++;
+    if (*name == '?') {
+        length = 1;
+    } else {
+        while (name[length] == '_' || (name[length] >= 'a' && name[length] <= 'z') ||
+               (name[length] >= 'A' && name[length] <= 'Z') ||
+               (length > 0 && name[length] >= '0' && name[length] <= '9')) {
+            length++;
+        }
+    }
+    if (length == 0 || (braces && name[length] != '}')) {
+        return NULL;
+    }
+
+    *last = name + length - 1 + braces;
+    if (*name == '?') {
+        snprintf(status, 16, "%d", last_status);
+        return status;
+    }
+    Variable *variable = variable_find(name, length);
+    return variable != NULL ? variable->value : "";
+}
+
+/**
+ * @brief Tells if a word has glob characters (*, ? or [) outside quotes.
+ */
+static int has_unquoted_glob(const char *word) {
+    char quote = 0;
+    for (const char *p = word; *p != '\0'; p++) {
+        if (quote != 0) {
+            if (*p == quote) quote = 0;
+        } else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        } else if (*p == '*' || *p == '?' || *p == '[') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Expands the variables of a word and removes its quotes.
+ *
+ * Supports $NAME, ${NAME} and $? anywhere in the word. Nothing is expanded
+ * between single quotes. An undefined variable expands to an empty string.
+ *
+ * When 'glob' is given and the word has unquoted glob characters, it is set to 1
+ * and the result is a pattern: quoted glob characters and backslashes are
+ * escaped with a backslash so they stay literal.
+ *
+ * @param word The word, as returned by next_word().
+ * @param pool Buffer receiving the expanded words, advanced past the result.
+ * @param pool_end End of the buffer.
+ * @param glob Set to 1 if the result is a glob pattern (may be NULL).
+ * @return The expanded word (inside the pool), or NULL if the pool is full.
+ */
+char *expand_word(const char *word, char **pool, char *pool_end, int *glob) {
+    char *result = *pool;
+    char quote = 0;
+    int pattern = 0;
+
+    if (glob != NULL) {
+        pattern = has_unquoted_glob(word);
+        *glob = pattern;
+    }
+
+    for (const char *p = word; *p != '\0'; p++) {
+        if (quote != '\'' && *p == '"') {
+            quote = quote == '"' ? 0 : '"';
+            continue;
+        }
+        if (quote != '"' && *p == '\'') {
+            quote = quote == '\'' ? 0 : '\'';
+            continue;
+        }
+
+        if (*p == '$' && quote != '\'') {
+            char status[16];
+            const char *value = reference_value(p, status, &p);
+            if (value != NULL) {
+                if (pool_append(pool, pool_end, value, strlen(value)) < 0) return NULL;
+                continue;
+            }
+        }
+
+        // In a pattern, protect the characters that must stay literal
+        if (pattern && (*p == '\\' || (quote != 0 && (*p == '*' || *p == '?' || *p == '[')))) {
+            if (pool_append(pool, pool_end, "\\", 1) < 0) return NULL;
+        }
+        if (pool_append(pool, pool_end, p, 1) < 0) return NULL;
+    }
+
+    if (pool_append(pool, pool_end, "", 1) < 0) return NULL;
+    return result;
+}
+
+/**
+ * @brief Expands the variables of a text, keeping everything else (quotes included) as is.
+ *
+ * Used for the bodies of here-documents, which can be much longer than a command.
+ *
+ * @return The expanded text, to be freed by the caller.
+ */
+char *expand_variables(const char *text) {
+    size_t capacity = strlen(text) + 1;
+    size_t length = 0;
+    char *result = malloc(capacity);
+
+    for (const char *p = text; *p != '\0'; p++) {
+        char status[16];
+        const char *value = NULL;
+        size_t size = 1;
+
+        if (*p == '$') {
+            value = reference_value(p, status, &p);
+        }
+        if (value != NULL) {
+            size = strlen(value);
+        } else {
+            value = p;
+        }
+
+        if (length + size + 1 > capacity) {
+            capacity = (length + size + 1) * 2;
+            result = realloc(result, capacity);
+        }
+        memcpy(result + length, value, size);
+        length += size;
+    }
+
+    result[length] = '\0';
+    return result;
+}
+
+/**
+ * @brief Builtin 'export': "export NAME[=value] ...", or the list of exported variables.
+ */
+void export_command(char **args) {
+    if (args[1] == NULL) {
+        for (char **entry = variables_environ(); *entry != NULL; entry++) {
+            printf("export %s\n", *entry);
+        }
+        return;
+    }
+
+    for (int i = 1; args[i] != NULL; i++) {
+        char *equal = strchr(args[i], '=');
+        if (equal != NULL) {
+            *equal = '\0';
+            variable_set(args[i], equal + 1, 1);
+        } else {
+            variable_export(args[i]);
+        }
+    }
+}
+
+/**
+ * @brief Builtin 'unset': "unset NAME ...".
+ */
+void unset_command(char **args) {
+    for (int i = 1; args[i] != NULL; i++) {
+        variable_unset(args[i]);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include "shell.h"
+
+#define VARIABLES_BUCKETS 64   // Initial size of the hash table, doubled when it gets full
+
+// A shell variable, stored in a bucket of the hash table
+typedef struct Variable {
+    char *name;
+    char *value;
+    int exported;              // 1 if the variable is passed to the commands
+    struct Variable *next;
+} Variable;
+
+extern int last_status;
+
+char *variable_get(const char *name);
+void variable_set(const char *name, const char *value, int exported);
+void variable_export(const char *name);
+void variable_unset(const char *name);
+char **variables_environ();
+int is_assignment(const char *word);
+char *next_word(char **cursor);
+char *find_unquoted(char *text, const char *separator);
+char *next_part(char **cursor, const char *separator);
+char *expand_word(const char *word, char **pool, char *pool_end, int *glob);
+char *expand_variables(const char *text);
+void export_command(char **args);
+void unset_command(char **args);
+
+#endif
@@ -0,0 +1,331 @@
+#include "zygote.h"
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define ZYGOTE_FDS 3  // stdin, stdout and stderr of the command
+
+// Helpers forked when the client starts, while its memory is still small
+static int helper_socket[ZYGOTE_MAX_HELPERS];  // -1 once the helper is gone
+static int helper_busy[ZYGOTE_MAX_HELPERS];    // 1 while a command of the client runs in the helper
+static int num_helpers = 0;
+static pid_t owner_pid = 0;  // Only the client talks to the helpers, not the processes it forks
+static int zygotes_paused = 0;  // Set by the benchmark to measure fork() alone
+
+/**
+ * @brief Receives a request and the descriptors that come with it.
+ *
+ * @return The length of the request, 0 if the client is gone, -1 on error.
+ */
+static ssize_t receive_request(int sock, char *request, int *fds) {
+    char control[CMSG_SPACE(sizeof(int) * ZYGOTE_FDS)];
+    struct iovec part = {request, ZYGOTE_MAX_REQUEST};
+    struct msghdr message = {0};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t length;
+    do {
+        length = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+    } while (length < 0 && errno == EINTR);
+    if (length <= 0) return length;
+
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (header == NULL || header->cmsg_type != SCM_RIGHTS ||
+        header->cmsg_len != CMSG_LEN(sizeof(int) * ZYGOTE_FDS)) {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(header), sizeof(int) * ZYGOTE_FDS);
+    return length;
+}
+
+/**
+ * @brief Runs a command for the client: fork (cheap here), exec, then report the status.
+ *
+ * The request holds the directory of the client, then the arguments and the
+ * environment, each as null-terminated strings after their counts.
+ */
+static void run_request(int sock, char *request, ssize_t length, int *fds) {
+    ZygoteResult result = {0};
+    uint32_t counts[2];
+    if (length < (ssize_t)sizeof(counts) || request[length - 1] != '\0') {
+        for (int k = 0; k < ZYGOTE_FDS; k++) close(fds[k]);
+        result.wstatus = EXIT_FAILURE << 8;
+        send(sock, &result, sizeof(result), MSG_NOSIGNAL);
+        return;
+    }
+    memcpy(counts, request, sizeof(counts));
+
+    char **args = malloc((counts[0] + counts[1] + 2) * sizeof(char *));
+    char **envp = args + counts[0] + 1;
+    char *cursor = request + sizeof(counts);
+    char *directory = cursor;
+    cursor += strlen(cursor) + 1;
+    for (uint32_t i = 0; i < counts[0] + counts[1]; i++) {
+        args[i + (i >= counts[0])] = cursor;
+        cursor += strlen(cursor) + 1;
+    }
+    args[counts[0]] = NULL;
+    envp[counts[1]] = NULL;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (int k = 0; k < ZYGOTE_FDS; k++) {
+            dup2(fds[k], k);
+        }
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        if (chdir(directory) == -1) {
+            perror("chdir error");
+        }
+        environ = envp;
+        execvp(args[0], args);
+        perror("execvp error");
+        _exit(EXIT_FAILURE);
+    }
+
+    for (int k = 0; k < ZYGOTE_FDS; k++) {
+        close(fds[k]);
+    }
+    if (pid < 0) {
+        perror("fork error");
+        result.wstatus = EXIT_FAILURE << 8;
+    } else {
+        while (wait4(pid, &result.wstatus, 0, &result.usage) < 0 && errno == EINTR);
+    }
+    free(args);
+
+    if (send(sock, &result, sizeof(result), MSG_NOSIGNAL) != sizeof(result)) {
+        _exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Main loop of a helper, until the client closes its end of the socket.
+ */
+static void helper_loop(int sock) {
+    char *request = malloc(ZYGOTE_MAX_REQUEST);
+    int fds[ZYGOTE_FDS];
+
+    // Ctrl+C is meant for the command, not for the helper
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTERM, SIG_DFL);
+
+    ssize_t length;
+    while ((length = receive_request(sock, request, fds)) > 0) {
+        run_request(sock, request, length, fds);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Starts the helpers asked in CLIENT_ZYGOTES (none by default).
+ *
+ * Each helper is forked now, while the client is small, and waits on its end
+ * of a socket pair. A simple command then costs the client a message instead
+ * of a fork() of its whole address space.
+ */
+void zygote_start() {
+    const char *value = getenv("CLIENT_ZYGOTES");
+    int count = value != NULL ? atoi(value) : 0;
+    if (count > ZYGOTE_MAX_HELPERS) count = ZYGOTE_MAX_HELPERS;
+
+    fflush(NULL);
+    for (int i = 0; i < count; i++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) == -1) {
+            perror("socketpair error");
+            break;
+        }
+
+        // Forked twice so the helper is not a child of the shell, whose wait4(-1) must not see it
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(pair[0]);
+            for (int k = 0; k < num_helpers; k++) {
+                close(helper_socket[k]);
+            }
+            if (fork() == 0) {
+                helper_loop(pair[1]);
+            }
+            _exit(EXIT_SUCCESS);
+        }
+        close(pair[1]);
+        if (pid < 0) {
+            perror("fork error");
+            close(pair[0]);
+            break;
+        }
+        waitpid(pid, NULL, 0);
+        helper_busy[num_helpers] = 0;
+        helper_socket[num_helpers++] = pair[0];
+    }
+    owner_pid = getpid();
+
+    if (num_helpers > 0) {
+        printf("%d zygote helper(s) started\n", num_helpers);
+    }
+}
+
+/**
+ * @brief Appends a string to a request.
+ *
+ * @return 0 on success, -1 if the request is full.
+ */
+static int request_append(char *request, size_t *length, const char *text) {
+    size_t size = strlen(text) + 1;
+    if (*length + size > ZYGOTE_MAX_REQUEST) return -1;
+    memcpy(request + *length, text, size);
+    *length += size;
+    return 0;
+}
+
+/**
+ * @brief Starts a command in a helper, with the current stdin, stdout and stderr.
+ *
+ * @param args The arguments of the command.
+ * @param envp The environment of the command.
+ * @return The helper running it, to give to zygote_wait(), or -1 if the caller
+ *         should fork() itself (no idle helper, a command too large, or a
+ *         process forked by the client).
+ */
+int zygote_spawn(char **args, char **envp) {
+    static char request[ZYGOTE_MAX_REQUEST];
+    // A forked child (parallel worker, producer) shares the sockets: it must not
+    // read the result of a command of the client, so it forks by itself
+    if (num_helpers == 0 || zygotes_paused || getpid() != owner_pid) return -1;
+
+    int helper = 0;
+    while (helper < num_helpers && (helper_socket[helper] == -1 || helper_busy[helper])) helper++;
+    if (helper == num_helpers) return -1;
+
+    uint32_t counts[2] = {0, 0};
+    size_t length = sizeof(counts);
+    char directory[MAX_LINE];
+    if (getcwd(directory, sizeof(directory)) == NULL || request_append(request, &length, directory) == -1) {
+        return -1;
+    }
+    for (; args[counts[0]] != NULL; counts[0]++) {
+        if (request_append(request, &length, args[counts[0]]) == -1) return -1;
+    }
+    for (; envp[counts[1]] != NULL; counts[1]++) {
+        if (request_append(request, &length, envp[counts[1]]) == -1) return -1;
+    }
+    memcpy(request, counts, sizeof(counts));
+
+    // The descriptors travel with the request, the helper's child gets them as 0, 1 and 2
+    int fds[ZYGOTE_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec part = {request, length};
+    struct msghdr message = {0};
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    if (sendmsg(helper_socket[helper], &message, MSG_NOSIGNAL) == -1) {
+        // The helper is gone (or the message too large): fork this time
+        if (errno != EMSGSIZE) {
+            perror("sendmsg error");
+            close(helper_socket[helper]);
+            helper_socket[helper] = -1;
+        }
+        return -1;
+    }
+    helper_busy[helper] = 1;
+    return helper;
+}
+
+/**
+ * @brief Waits for the command started by zygote_spawn().
+ *
+ * @param helper The helper running the command.
+ * @param wstatus Receives the status of the command, as given by wait4().
+ * @param usage Receives the resources used by the command.
+ * @return 0 on success, -1 if the helper died.
+ */
+int zygote_wait(int helper, int *wstatus, struct rusage *usage) {
+    ZygoteResult result;
+    ssize_t received;
+
+    do {
+        received = recv(helper_socket[helper], &result, sizeof(result), 0);
+    } while (received < 0 && errno == EINTR);
+    helper_busy[helper] = 0;
+
+    if (received != sizeof(result)) {
+        printf("Zygote helper %d stopped, commands are forked again\n", helper);
+        close(helper_socket[helper]);
+        helper_socket[helper] = -1;
+        *wstatus = EXIT_FAILURE << 8;
+        memset(usage, 0, sizeof(*usage));
+        return -1;
+    }
+    *wstatus = result.wstatus;
+    *usage = result.usage;
+    return 0;
+}
+
+/**
+ * @brief Compares two durations, for qsort().
+ */
+static int compare_durations(const void *a, const void *b) {
+    double first = *(const double *)a;
+    double second = *(const double *)b;
+    return (first > second) - (first < second);
+}
+
+/**
+ * @brief Runs a command many times with fork() and with the helpers, and prints the latencies.
+ *
+ * The ballast stands for the memory a long-running client accumulates, which
+ * fork() has to copy the page tables of on every command.
+ *
+ * @param runs The number of runs of each mode.
+ * @param ballast_mb The memory touched by the benchmark before measuring, in MB.
+ * @param command The command, e.g. "uptime > /dev/null".
+ */
+void zygote_bench(int runs, size_t ballast_mb, const char *command) {
+    if (num_helpers == 0) {
+        setenv("CLIENT_ZYGOTES", "1", 0);
+        zygote_start();
+    }
+    if (num_helpers == 0) return;
+
+    char *ballast = malloc(ballast_mb * 1024 * 1024 + 1);
+    memset(ballast, 1, ballast_mb * 1024 * 1024 + 1);
+    double *durations = malloc(runs * sizeof(double));
+    char line[MAX_LINE];
+
+    printf("%d runs of '%s' with %zu MB of client memory\n", runs, command, ballast_mb);
+    for (int mode = 0; mode < 2; mode++) {
+        zygotes_paused = (mode == 0);
+        for (int i = 0; i < runs; i++) {
+            struct timespec start, end;
+            snprintf(line, sizeof(line), "%s", command);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            execute_command(line);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            durations[i] = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+        }
+
+        qsort(durations, runs, sizeof(double), compare_durations);
+        printf("  %-7s p50 %7.3f ms   p90 %7.3f ms   p99 %7.3f ms   max %7.3f ms\n",
+               mode == 0 ? "fork" : "zygote", durations[runs / 2], durations[runs * 90 / 100],
+               durations[runs * 99 / 100], durations[runs - 1]);
+    }
+
+    zygotes_paused = 0;
+    free(durations);
+    free(ballast);
+}
@@ -0,0 +1,21 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include "shell.h"
+#include <sys/resource.h>
+
+#define ZYGOTE_MAX_HELPERS 16            // Largest pool accepted in CLIENT_ZYGOTES
+#define ZYGOTE_MAX_REQUEST (64 * 1024)   // Largest command (directory, arguments and environment) sent to a helper
+
+// Result of a command run by a helper
+typedef struct {
+    int wstatus;               // As given by wait4()
+    struct rusage usage;
+} ZygoteResult;
+
+void zygote_start();
+int zygote_spawn(char **args, char **envp);
+int zygote_wait(int helper, int *wstatus, struct rusage *usage);
+void zygote_bench(int runs, size_t ballast_mb, const char *command);
+
+#endif